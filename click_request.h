@@ -0,0 +1,127 @@
+#pragma once
+
+#include <charconv>
+#include <cstdint>
+#include <string_view>
+
+// Body of POST /api/click: {"player": "...", "delta": 1, "nonce": 42}
+// player points into the request body, so the body must outlive it.
+struct ClickRequest {
+    std::string_view player;
+    int delta = 0;
+    uint64_t nonce = 0;
+};
+
+// Reads the known click fields straight from the body without building a
+// JSON tree or allocating. Unknown fields are skipped, escaped strings are
+// rejected, and every read is bounds checked so any input is safe to feed.
+class ClickRequestReader {
+private:
+    static constexpr int maxDepth = 16;
+
+    std::string_view body;
+    size_t pos = 0;
+
+    void skipWhitespace() {
+        while (pos < body.size() && (body[pos] == ' ' || body[pos] == '\t' || body[pos] == '\n' || body[pos] == '\r')) {
+            ++pos;
+        }
+    }
+
+    bool consume(char c) {
+        skipWhitespace();
+        if (pos < body.size() && body[pos] == c) {
+            ++pos;
+            return true;
+        }
+        return false;
+    }
+
+    bool readString(std::string_view& out) {
+        if (!consume('"')) return false;
+        size_t start = pos;
+        while (pos < body.size() && body[pos] != '"') {
+            if (body[pos] == '\\' || static_cast<unsigned char>(body[pos]) < 0x20) return false;
+            ++pos;
+        }
+        if (pos == body.size()) return false;
+        out = body.substr(start, pos - start);
+        ++pos;
+        return true;
+    }
+
+    template<typename T>
+    bool readNumber(T& out) {
+        skipWhitespace();
+        auto result = std::from_chars(body.data() + pos, body.data() + body.size(), out);
+        if (result.ec != std::errc()) return false;
+        pos = result.ptr - body.data();
+        return true;
+    }
+
+    // Skips any JSON value, tracking nesting so brackets inside strings don't
+    // count; fails on an empty value and on brackets that don't pair up
+    bool skipValue() {
+        skipWhitespace();
+        size_t start = pos;
+        char open[maxDepth];
+        int depth = 0;
+        while (pos < body.size()) {
+            char c = body[pos];
+            if (c == '"') {
+                ++pos;
+                while (pos < body.size() && body[pos] != '"') {
+                    pos += body[pos] == '\\' ? 2 : 1;
+                }
+                if (pos >= body.size()) return false;
+                ++pos;
+            } else if (c == '{' || c == '[') {
+                if (depth == maxDepth) return false;
+                open[depth++] = c;
+                ++pos;
+            } else if (c == '}' || c == ']') {
+                if (depth == 0) return pos != start; // Closes the object holding this value
+                if (open[--depth] != (c == '}' ? '{' : '[')) return false;
+                ++pos;
+            } else if (c == ',' && depth == 0) {
+                return pos != start;
+            } else {
+                ++pos;
+            }
+            if (depth == 0 && (c == '"' || c == '}' || c == ']')) return true;
+        }
+        return depth == 0 && pos != start;
+    }
+
+public:
+    explicit ClickRequestReader(std::string_view body) : body(body) {}
+
+    bool read(ClickRequest& click) {
+        bool hasPlayer = false, hasDelta = false;
+
+        if (!consume('{')) return false;
+        if (!consume('}')) {
+            do {
+                std::string_view key;
+                if (!readString(key) || !consume(':')) return false;
+
+                if (key == "player") {
+                    if (!readString(click.player)) return false;
+                    hasPlayer = true;
+                } else if (key == "delta") {
+                    if (!readNumber(click.delta)) return false;
+                    hasDelta = true;
+                } else if (key == "nonce") {
+                    if (!readNumber(click.nonce)) return false;
+                } else if (!skipValue()) {
+                    return false;
+                }
+            } while (consume(','));
+
+            if (!consume('}')) return false;
+        }
+
+        skipWhitespace();
+        return pos == body.size() && hasPlayer && hasDelta;
+    }
+};
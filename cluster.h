@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <vector>
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace cluster_detail {
+    inline volatile std::sig_atomic_t stopping = 0;
+
+    inline void onStopSignal(int) {
+        stopping = 1;
+    }
+}
+
+// Forks one process per worker and replaces any worker that crashes, until
+// the master gets SIGINT or SIGTERM; then it stops the workers and returns.
+// Workers are expected to listen with SO_REUSEPORT on the same port, or to
+// share a listening socket opened before the fork. onStarted runs once all
+// workers have been forked.
+inline int runCluster(int workers, const std::function<int(uint32_t)>& runWorker,
+                      const std::function<void()>& onStarted = nullptr) {
+    std::vector<pid_t> pids(workers, -1);
+
+    struct sigaction action {};
+    action.sa_handler = cluster_detail::onStopSignal;
+    sigemptyset(&action.sa_mask);
+    // No SA_RESTART, so waitpid returns as soon as a stop signal arrives
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+
+    auto spawn = [&](uint32_t worker) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            signal(SIGINT, SIG_DFL);
+            signal(SIGTERM, SIG_DFL);
+            _exit(runWorker(worker));
+        }
+        if (pid < 0) {
+            std::cerr << "Could not fork worker " << worker << std::endl;
+        }
+        pids[worker] = pid;
+    };
+
+    for (int i = 0; i < workers; ++i) {
+        spawn(i);
+    }
+    if (onStarted) onStarted();
+
+    while (!cluster_detail::stopping) {
+        int status;
+        pid_t pid = waitpid(-1, &status, 0);
+        if (pid < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        for (int i = 0; i < workers; ++i) {
+            if (pids[i] != pid) continue;
+            pids[i] = -1;
+            bool crashed = WIFSIGNALED(status) || (WIFEXITED(status) && WEXITSTATUS(status) != 0);
+            if (crashed && !cluster_detail::stopping) {
+                std::cerr << "Worker " << i << " (pid " << pid << ") died, restarting" << std::endl;
+                spawn(i);
+            }
+        }
+    }
+
+    for (pid_t pid : pids) {
+        if (pid > 0) kill(pid, SIGTERM);
+    }
+    while (waitpid(-1, nullptr, 0) > 0) {
+    }
+    return 0;
+}
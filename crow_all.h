@@ -509,11 +509,15 @@ namespace crow
             if (url_.empty())
                 return;
 
-            key_value_pairs_.resize(MAX_KEY_VALUE_PAIRS_COUNT);
-            size_t count = qs_parse(&url_[0], &key_value_pairs_[0], MAX_KEY_VALUE_PAIRS_COUNT, url);
+            // A URL without a query or fragment has nothing to parse, skip the scratch table entirely.
+            if (url && url_.find_first_of("?#") == std::string::npos)
+                return;
+
+            // Parse into a stack table and copy out only the pairs found, so the vector is allocated once at its final size.
+            char* pairs[MAX_KEY_VALUE_PAIRS_COUNT];
+            size_t count = qs_parse(&url_[0], pairs, MAX_KEY_VALUE_PAIRS_COUNT, url);
 
-            key_value_pairs_.resize(count);
-            key_value_pairs_.shrink_to_fit();
+            key_value_pairs_.assign(pairs, pairs + count);
         }
 
         void clear()
@@ -3274,6 +3278,14 @@ typedef unsigned __int64 uint64_t;
 #include <string.h>
 #include <limits.h>
 }
+#if defined(__SSE2__) && !defined(CROW_DISABLE_SIMD_HTTP_PARSER)
+#include <emmintrin.h>
+#define CROW_SIMD_HTTP_PARSER
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define CROW_SIMD_HTTP_PARSER_AVX2
+#endif
+#endif
 
 namespace crow
 {
@@ -3696,6 +3708,90 @@ enum http_host_state
 #define CROW_IS_HEADER_CHAR(ch)                                                     \
   (ch == cr || ch == lf || ch == 9 || ((unsigned char)ch > 31 && ch != 127))
 
+/**
+ * Bytes that need no further checks in a header value: printable US-ASCII
+ * and %x80-FF. Anything else stops a skip_plain_chars scan.
+ **/
+struct plain_header_chars
+{
+#ifdef CROW_SIMD_HTTP_PARSER
+  static unsigned stops(__m128i block)
+  {
+    __m128i is_ctl = _mm_cmpeq_epi8(_mm_min_epu8(block, _mm_set1_epi8(0x1f)), block);
+    __m128i is_del = _mm_cmpeq_epi8(block, _mm_set1_epi8(0x7f));
+    return static_cast<unsigned>(_mm_movemask_epi8(_mm_or_si128(is_ctl, is_del)));
+  }
+#endif
+#ifdef CROW_SIMD_HTTP_PARSER_AVX2
+  static unsigned stops(__m256i block)
+  {
+    __m256i is_ctl = _mm256_cmpeq_epi8(_mm256_min_epu8(block, _mm256_set1_epi8(0x1f)), block);
+    __m256i is_del = _mm256_cmpeq_epi8(block, _mm256_set1_epi8(0x7f));
+    return static_cast<unsigned>(_mm256_movemask_epi8(_mm256_or_si256(is_ctl, is_del)));
+  }
+#endif
+};
+
+/**
+ * Bytes that keep a request path or query string in its state: visible
+ * US-ASCII other than '#' and '?'. '?' is left to parse_url_char since it
+ * starts the query string.
+ **/
+struct plain_url_chars
+{
+#ifdef CROW_SIMD_HTTP_PARSER
+  static unsigned stops(__m128i block)
+  {
+    __m128i offset = _mm_sub_epi8(block, _mm_set1_epi8(0x21));
+    __m128i visible = _mm_cmpeq_epi8(_mm_min_epu8(offset, _mm_set1_epi8(0x7e - 0x21)), offset);
+    __m128i special = _mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8('#')), _mm_cmpeq_epi8(block, _mm_set1_epi8('?')));
+    return static_cast<unsigned>(_mm_movemask_epi8(_mm_andnot_si128(visible, _mm_set1_epi8(-1))) | _mm_movemask_epi8(special));
+  }
+#endif
+#ifdef CROW_SIMD_HTTP_PARSER_AVX2
+  static unsigned stops(__m256i block)
+  {
+    __m256i offset = _mm256_sub_epi8(block, _mm256_set1_epi8(0x21));
+    __m256i visible = _mm256_cmpeq_epi8(_mm256_min_epu8(offset, _mm256_set1_epi8(0x7e - 0x21)), offset);
+    __m256i special = _mm256_or_si256(_mm256_cmpeq_epi8(block, _mm256_set1_epi8('#')), _mm256_cmpeq_epi8(block, _mm256_set1_epi8('?')));
+    return ~static_cast<unsigned>(_mm256_movemask_epi8(visible)) | static_cast<unsigned>(_mm256_movemask_epi8(special));
+  }
+#endif
+};
+
+/**
+ * Skip over bytes of the given class, 32 at a time when the build targets
+ * AVX2, then 16 at a time with SSE2 compares. SSE4.2 PCMPESTRI ranges are
+ * not used: they took twice as long as the compares on browser headers.
+ * Returns the first byte outside the class, or the position where too few
+ * bytes are left for a block, so the byte-wise code still decides on
+ * delimiters and errors. Define CROW_DISABLE_SIMD_HTTP_PARSER to always use
+ * the byte-wise loops.
+ **/
+template<typename Chars>
+static inline const char* skip_plain_chars(const char* p, const char* pe)
+{
+#ifdef CROW_SIMD_HTTP_PARSER_AVX2
+  while (pe - p >= 32) {
+    unsigned mask = Chars::stops(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)));
+    if (mask != 0)
+      return p + __builtin_ctz(mask);
+    p += 32;
+  }
+#endif
+#ifdef CROW_SIMD_HTTP_PARSER
+  while (pe - p >= 16) {
+    unsigned mask = Chars::stops(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+    if (mask != 0)
+      return p + __builtin_ctz(mask);
+    p += 16;
+  }
+#else
+  (void)pe;
+#endif
+  return p;
+}
+
 #define CROW_start_state s_start_req
 
 # define CROW_STRICT_CHECK(cond)                                     \
@@ -4148,6 +4244,16 @@ reexecute:
       case s_req_query_string_start:
       case s_req_query_string:
       {
+        if (parser->state == s_req_path || parser->state == s_req_query_string) {
+          /* Bytes that keep the state only need counting */
+          const char* next = skip_plain_chars<plain_url_chars>(p, data + len);
+          if (next != p) {
+            CROW_COUNT_HEADER_SIZE(next - p - 1);
+            p = next - 1;
+            break;
+          }
+        }
+
         switch (ch) {
           case ' ':
             parser->state = s_req_http_start;
@@ -4610,6 +4716,7 @@ reexecute:
                 size_t left = data + len - p;
                 const char* pe = p + CROW_MIN(left, max_header_size);
 
+                p = skip_plain_chars<plain_header_chars>(p, pe);
                 for (; p != pe; p++) {
                   ch = *p;
                   if (ch == cr || ch == lf) {
@@ -5266,6 +5373,9 @@ namespace crow
     template<typename Handler>
     struct HTTPParser : public http_parser
     {
+        /// Number of headers a typical browser request carries, used to presize the header map.
+        static constexpr size_t EXPECTED_HEADER_COUNT = 16;
+
         static int on_message_begin(http_parser*)
         {
             return 0;
@@ -5281,7 +5391,9 @@ namespace crow
         {
             HTTPParser* self = static_cast<HTTPParser*>(self_);
             self->req.raw_url.insert(self->req.raw_url.end(), at, at + length);
-            self->req.url_params = query_string(self->req.raw_url);
+            // Plain paths like "GET /" carry no parameters, don't copy the URL into a query_string for them.
+            if (self->req.raw_url.find_first_of("?#") != std::string::npos)
+                self->req.url_params = query_string(self->req.raw_url);
             self->req.url = self->req.raw_url.substr(0, self->qs_point != 0 ? self->qs_point : std::string::npos);
 
             self->process_url();
@@ -5298,6 +5410,11 @@ namespace crow
                     {
                         self->req.headers.emplace(std::move(self->header_field), std::move(self->header_value));
                     }
+                    else if (self->req.headers.empty())
+                    {
+                        // First header, size the map once instead of rehashing as it grows.
+                        self->req.headers.reserve(EXPECTED_HEADER_COUNT);
+                    }
                     self->header_field.assign(at, at + length);
                     self->header_building_state = 1;
                     break;
@@ -5332,12 +5449,33 @@ namespace crow
 
             self->set_connection_parameters();
 
+            // A declared Content-Length over the limit is rejected before any of the body arrives.
+            if (!(self->flags & F_CHUNKED) && self->content_length != CROW_ULLONG_MAX && self->content_length > self->handler_->max_body_size())
+            {
+                self->body_limit_exceeded = true;
+                self->handler_->handle_body_limit_exceeded();
+                // Stop here: the rest of the input is body, never another request.
+                return -1;
+            }
+
             self->process_header();
             return 0;
         }
         static int on_body(http_parser* self_, const char* at, size_t length)
         {
             HTTPParser* self = static_cast<HTTPParser*>(self_);
+            if (self->body_limit_exceeded)
+                return 0;
+
+            // Chunked bodies have no declared size, so the limit is checked as they grow.
+            if (self->req.body.size() + length > self->handler_->max_body_size())
+            {
+                self->body_limit_exceeded = true;
+                self->req.body.clear();
+                self->handler_->handle_body_limit_exceeded();
+                return -1;
+            }
+
             self->req.body.insert(self->req.body.end(), at, at + length);
             return 0;
         }
@@ -5346,7 +5484,8 @@ namespace crow
             HTTPParser* self = static_cast<HTTPParser*>(self_);
 
             self->message_complete = true;
-            self->process_message();
+            if (!self->body_limit_exceeded)
+                self->process_message();
             return 0;
         }
         HTTPParser(Handler* handler):
@@ -5395,6 +5534,7 @@ namespace crow
             header_building_state = 0;
             qs_point = 0;
             message_complete = false;
+            body_limit_exceeded = false;
             state = CROW_NEW_MESSAGE();
         }
 
@@ -5440,6 +5580,7 @@ namespace crow
     private:
         int header_building_state = 0;
         bool message_complete = false;
+        bool body_limit_exceeded = false;
         std::string header_field;
         std::string header_value;
 
@@ -5626,7 +5767,10 @@ namespace crow
 #endif
 #include <iostream>
 #include <algorithm>
+#include <charconv>
 #include <memory>
+#include <string_view>
+#include <type_traits>
 #include <vector>
 #include <cmath>
 #include <cfloat>
@@ -5653,11 +5797,20 @@ namespace crow // NOTE: Already documented in "crow/app.h"
             return 'a' + c - 10;
         }
 
-        inline void escape(const std::string& str, std::string& ret)
+        inline void escape(std::string_view str, std::string& ret)
         {
             ret.reserve(ret.size() + str.size() + str.size() / 4);
-            for (auto c : str)
+            const char* run = str.data();
+            const char* end = str.data() + str.size();
+            for (const char* p = run; p != end; ++p)
             {
+                char c = *p;
+                // Most characters are copied as they are, append them in runs instead of one at a time.
+                if (c != '"' && c != '\\' && !(c >= 0 && c < 0x20))
+                    continue;
+
+                ret.append(run, p);
+                run = p + 1;
                 switch (c)
                 {
                     case '"': ret += "\\\""; break;
@@ -5668,17 +5821,13 @@ namespace crow // NOTE: Already documented in "crow/app.h"
                     case '\r': ret += "\\r"; break;
                     case '\t': ret += "\\t"; break;
                     default:
-                        if (c >= 0 && c < 0x20)
-                        {
-                            ret += "\\u00";
-                            ret += to_hex(c / 16);
-                            ret += to_hex(c % 16);
-                        }
-                        else
-                            ret += c;
+                        ret += "\\u00";
+                        ret += to_hex(c / 16);
+                        ret += to_hex(c % 16);
                         break;
                 }
             }
+            ret.append(run, end);
         }
         inline std::string escape(const std::string& str)
         {
@@ -7541,13 +7690,14 @@ namespace crow // NOTE: Already documented in "crow/app.h"
                                 *pos_first_trailing_0 = '\0';
                             out += outbuf;
                         }
-                        else if (v.nt == num_type::Signed_integer)
-                        {
-                            out += std::to_string(v.num.si);
-                        }
                         else
                         {
-                            out += std::to_string(v.num.ui);
+                            // Integers go straight into the output through a stack buffer, without a temporary string.
+                            char outbuf[24];
+                            auto result = v.nt == num_type::Signed_integer ?
+                                            std::to_chars(std::begin(outbuf), std::end(outbuf), v.num.si) :
+                                            std::to_chars(std::begin(outbuf), std::end(outbuf), v.num.ui);
+                            out.append(outbuf, result.ptr);
                         }
                     }
                     break;
@@ -7690,6 +7840,136 @@ namespace crow // NOTE: Already documented in "crow/app.h"
             const wvalue& ref;
         };
 
+        /// Writes JSON straight into a string, without building a wvalue tree first.
+        ///
+        /// For responses whose shape is fixed in code and sent often. Members come out in the
+        /// order they are written, and the caller keeps objects and arrays balanced.
+        class writer
+        {
+        public:
+            explicit writer(size_t reserve = 256)
+            {
+                out_.reserve(reserve);
+            }
+
+            writer& begin_object()
+            {
+                separate();
+                out_.push_back('{');
+                first_ = true;
+                return *this;
+            }
+
+            writer& end_object()
+            {
+                out_.push_back('}');
+                first_ = false;
+                return *this;
+            }
+
+            writer& begin_array()
+            {
+                separate();
+                out_.push_back('[');
+                first_ = true;
+                return *this;
+            }
+
+            writer& end_array()
+            {
+                out_.push_back(']');
+                first_ = false;
+                return *this;
+            }
+
+            /// Starts an object member, its value is the next thing written.
+            writer& key(std::string_view name)
+            {
+                separate();
+                write_string(name);
+                out_.push_back(':');
+                first_ = true;
+                return *this;
+            }
+
+            writer& value(std::string_view str)
+            {
+                separate();
+                write_string(str);
+                return *this;
+            }
+
+            writer& value(const char* str)
+            {
+                return value(std::string_view(str));
+            }
+
+            writer& value(bool b)
+            {
+                separate();
+                out_ += b ? "true" : "false";
+                return *this;
+            }
+
+            template<typename T, typename std::enable_if<std::is_integral<T>::value && !std::is_same<T, bool>::value, int>::type = 0>
+            writer& value(T number)
+            {
+                separate();
+                char buffer[24];
+                out_.append(buffer, std::to_chars(std::begin(buffer), std::end(buffer), number).ptr);
+                return *this;
+            }
+
+            /// Shortest form that reads back as the same double, null for NaN and infinity like wvalue.
+            writer& value(double number)
+            {
+                separate();
+                if (isnan(number) || isinf(number))
+                {
+                    out_ += "null";
+                    return *this;
+                }
+                char buffer[32];
+                out_.append(buffer, std::to_chars(std::begin(buffer), std::end(buffer), number).ptr);
+                return *this;
+            }
+
+            writer& null()
+            {
+                separate();
+                out_ += "null";
+                return *this;
+            }
+
+            const std::string& str() const&
+            {
+                return out_;
+            }
+
+            std::string str() &&
+            {
+                return std::move(out_);
+            }
+
+        private:
+            void separate()
+            {
+                if (!first_)
+                    out_.push_back(',');
+                first_ = false;
+            }
+
+            void write_string(std::string_view str)
+            {
+                out_.push_back('"');
+                escape(str, out_);
+                out_.push_back('"');
+            }
+
+            std::string out_;
+            bool first_ = true;
+        };
+
         //std::vector<asio::const_buffer> dump_ref(wvalue& v)
         //{
         //}
@@ -7876,9 +8156,17 @@ namespace crow
             code = 200;
             headers.clear();
             completed_ = false;
+            deferred_ = false;
             file_info = static_file_info{};
         }
 
+        /// Skip the route handler: a middleware that calls this in before_handle takes the response
+        /// over and calls end() later, from the request's io_context.
+        void defer()
+        {
+            deferred_ = true;
+        }
+
         /// Return a "Temporary Redirect" response.
 
         ///
@@ -7938,7 +8226,10 @@ namespace crow
                 }
                 if (complete_request_handler_)
                 {
-                    complete_request_handler_();
+                    // The handler clears itself, and for a response completed later it
+                    // holds the last reference to the connection this response lives in
+                    auto complete_request_handler = complete_request_handler_;
+                    complete_request_handler();
                     manual_length_header = false;
                     skip_body = false;
                 }
@@ -8011,6 +8302,7 @@ namespace crow
 
     private:
         bool completed_{};
+        bool deferred_{};
         std::function<void()> complete_request_handler_;
         std::function<bool()> is_alive_helper_;
         static_file_info file_info;
@@ -9406,6 +9698,15 @@ namespace crow
                 return tick_length_ms_;
             }
 
+            /// Bring every scheduled task forward so it runs within the given
+            /// amount of ticks. Must be called from the timer's io_context.
+            void expire_within(uint8_t timeout)
+            {
+                time_type limit = clock_type::now() + (timeout * tick_length_ms_);
+                for (auto& task : tasks_)
+                    task.second.first = (std::min)(task.second.first, limit);
+            }
+
         private:
             void process_tasks()
             {
@@ -9488,6 +9789,18 @@ namespace crow
     static std::atomic<int> connectionCount;
 #endif
 
+    namespace detail
+    {
+        /// Connection accounting shared by a server and its connections, used to drain before stopping.
+        struct connection_counts
+        {
+            std::atomic<bool> draining{false}; ///< Every response closes its connection once set
+            std::atomic<unsigned int> open{0};   ///< Started connections, websockets excluded
+            std::atomic<unsigned int> active{0}; ///< Requests being handled
+            std::atomic<uint64_t> completed{0};  ///< Responses written
+        };
+    } // namespace detail
+
     /// An HTTP connection.
     template<typename Adaptor, typename Handler, typename... Middlewares>
     class Connection : public std::enable_shared_from_this<Connection<Adaptor, Handler, Middlewares...>>
@@ -9503,7 +9816,8 @@ namespace crow
           std::function<std::string()>& get_cached_date_str_f,
           detail::task_timer& task_timer,
           typename Adaptor::context* adaptor_ctx_,
-          std::atomic<unsigned int>& queue_length):
+          std::atomic<unsigned int>& queue_length,
+          detail::connection_counts& counts):
           adaptor_(io_context, adaptor_ctx_),
           handler_(handler),
           parser_(this),
@@ -9513,7 +9827,9 @@ namespace crow
           get_cached_date_str(get_cached_date_str_f),
           task_timer_(task_timer),
           res_stream_threshold_(handler->stream_threshold()),
-          queue_length_(queue_length)
+          max_body_size_(handler->max_body_size()),
+          queue_length_(queue_length),
+          counts_(counts)
         {
 #ifdef CROW_ENABLE_DEBUG
             connectionCount++;
@@ -9523,6 +9839,10 @@ namespace crow
 
         ~Connection()
         {
+            if (started_)
+                counts_.open--;
+            if (active_)
+                counts_.active--;
 #ifdef CROW_ENABLE_DEBUG
             connectionCount--;
             CROW_LOG_DEBUG << "Connection (" << this << ") freed, total: " << connectionCount;
@@ -9537,6 +9857,8 @@ namespace crow
 
         void start()
         {
+            started_ = true;
+            counts_.open++;
             auto self = this->shared_from_this();
             adaptor_.start([self](const error_code& ec) {
                 if (!ec)
@@ -9565,6 +9887,23 @@ namespace crow
             }
         }
 
+        /// Answer with 413 once the body is known to be over the limit. The parser stops there and the rest of the input is dropped unread, see do_read.
+        void handle_body_limit_exceeded()
+        {
+            CROW_LOG_INFO << "Request body too large: " << this << ' ' << req_.raw_url;
+            cancel_deadline_timer();
+            res = response(status::PAYLOAD_TOO_LARGE);
+            close_connection_ = true;
+            discard_input_ = true;
+            need_to_call_after_handlers_ = false;
+            complete_request();
+        }
+
+        uint64_t max_body_size() const
+        {
+            return max_body_size_;
+        }
+
         void handle_header()
         {
             // HTTP 1.1 Expect: 100-continue
@@ -9626,6 +9965,9 @@ namespace crow
             CROW_LOG_INFO << "Request: " << utility::lexical_cast<std::string>(adaptor_.remote_endpoint()) << " " << this << " HTTP/" << (char)(req_.http_ver_major + '0') << "." << (char)(req_.http_ver_minor + '0') << ' ' << method_name(req_.method) << " " << req_.url;
 
 
+            active_ = true;
+            counts_.active++;
+
             need_to_call_after_handlers_ = false;
             if (!is_invalid_request)
             {
@@ -9644,7 +9986,8 @@ namespace crow
                         self->complete_request();
                     };
                     need_to_call_after_handlers_ = true;
-                    handler_->handle(req_, res, routing_handle_result_);
+                    if (!res.deferred_)
+                        handler_->handle(req_, res, routing_handle_result_);
                     if (add_keep_alive_)
                         res.set_header("connection", "Keep-Alive");
                 }
@@ -9665,6 +10008,14 @@ namespace crow
             CROW_LOG_INFO << "Response: " << this << ' ' << req_.raw_url << ' ' << res.code << ' ' << close_connection_;
             res.is_alive_helper_ = nullptr;
 
+            if (counts_.draining)
+            {
+                // Tell keep-alive clients to reconnect, which takes them to another server
+                close_connection_ = true;
+                add_keep_alive_ = false;
+                res.set_header("connection", "close");
+            }
+
             if (need_to_call_after_handlers_)
             {
                 need_to_call_after_handlers_ = false;
@@ -9715,6 +10066,13 @@ namespace crow
             {
                 do_write_general();
             }
+
+            counts_.completed++;
+            if (active_)
+            {
+                active_ = false;
+                counts_.active--;
+            }
         }
 
     private:
@@ -9878,8 +10236,11 @@ namespace crow
                 if (need_to_start_read_after_complete_)
                 {
                     need_to_start_read_after_complete_ = false;
-                    start_deadline();
-                    do_read();
+                    if (!close_connection_)
+                    {
+                        start_deadline();
+                        do_read();
+                    }
                 }
             }
             else
@@ -9929,7 +10290,16 @@ namespace crow
                       }
                   }
 
-                  if (error_while_reading)
+                  if (self->discard_input_ && !ec && self->adaptor_.is_open())
+                  {
+                      // The response is out, but closing with unread body bytes would reset the
+                      // connection before the client reads it. Signal the end instead and drop what
+                      // is still coming until the client closes, up to a limit or the deadline.
+                      self->adaptor_.shutdown_write();
+                      self->start_deadline();
+                      self->do_discard(discard_limit);
+                  }
+                  else if (error_while_reading)
                   {
                       self->cancel_deadline_timer();
                       self->parser_.done();
@@ -9956,6 +10326,23 @@ namespace crow
               });
         }
 
+        void do_discard(size_t budget)
+        {
+            auto self = this->shared_from_this();
+            adaptor_.socket().async_read_some(
+              asio::buffer(buffer_),
+              [self, budget](const error_code& ec, std::size_t bytes_transferred) {
+                  if (ec || bytes_transferred >= budget)
+                  {
+                      self->cancel_deadline_timer();
+                      self->adaptor_.close();
+                      CROW_LOG_DEBUG << self << " from discard";
+                      return;
+                  }
+                  self->do_discard(budget - bytes_transferred);
+              });
+        }
+
         void do_write()
         {
             auto self = this->shared_from_this();
@@ -10046,6 +10433,8 @@ namespace crow
         response res;
 
         bool close_connection_ = false;
+        bool discard_input_ = false; ///< Drop the rest of the input before closing, see do_read.
+        static constexpr size_t discard_limit = 1 << 20;
 
         const std::string& server_name_;
         std::vector<asio::const_buffer> buffers_;
@@ -10068,8 +10457,13 @@ namespace crow
         detail::task_timer& task_timer_;
 
         size_t res_stream_threshold_;
+        uint64_t max_body_size_;
 
         std::atomic<unsigned int>& queue_length_;
+
+        detail::connection_counts& counts_;
+        bool started_{};
+        bool active_{};
     };
 
 } // namespace crow
@@ -10127,11 +10521,81 @@ namespace crow // NOTE: Already documented in "crow/app.h"
             EndStatusCodes = 4999,
         };
 
+        /// Generate the websocket headers using an opcode and the message size (in bytes).
+        inline std::string build_frame_header(int opcode, size_t size)
+        {
+            char buf[2 + 8] = "\x80\x00";
+            buf[0] += opcode;
+            if (size < 126)
+            {
+                buf[1] += static_cast<char>(size);
+                return {buf, buf + 2};
+            }
+            else if (size < 0x10000)
+            {
+                buf[1] += 126;
+                *(uint16_t*)(buf + 2) = htons(static_cast<uint16_t>(size));
+                return {buf, buf + 4};
+            }
+            else
+            {
+                buf[1] += 127;
+                *reinterpret_cast<uint64_t*>(buf + 2) = ((1 == htonl(1)) ? static_cast<uint64_t>(size) : (static_cast<uint64_t>(htonl((size)&0xFFFFFFFF)) << 32) | htonl(static_cast<uint64_t>(size) >> 32));
+                return {buf, buf + 10};
+            }
+        }
+
+        /// An immutable, reference counted frame (header and payload) for broadcasting.
+
+        ///
+        /// The frame is encoded once, every connection it is sent to only queues another reference to it.
+        class shared_frame
+        {
+        public:
+            static shared_frame text(const std::string& msg)
+            {
+                return shared_frame(0x1, msg);
+            }
+
+            static shared_frame binary(const std::string& msg)
+            {
+                return shared_frame(0x2, msg);
+            }
+
+            /// The encoded frame, as written to the socket.
+            const std::string& data() const
+            {
+                return *data_;
+            }
+
+        private:
+            shared_frame(int opcode, const std::string& msg)
+            {
+                std::string data = build_frame_header(opcode, msg.size());
+                data.append(msg);
+                data_ = std::make_shared<const std::string>(std::move(data));
+            }
+
+            std::shared_ptr<const std::string> data_;
+
+            template<typename Adaptor, typename Handler>
+            friend class Connection;
+        };
+
+        /// Counters for writes that never reached a slow client, shared by all connections of an app.
+        struct stats
+        {
+            std::atomic<uint64_t> conflated{0}; ///< Frames replaced by a newer one sent with send_latest().
+            std::atomic<uint64_t> dropped{0};   ///< Messages discarded because the queue limit was reached.
+        };
+
         /// A base class for websocket connection.
         struct connection
         {
             virtual void send_binary(std::string msg) = 0;
             virtual void send_text(std::string msg) = 0;
+            virtual void send_frame(const shared_frame& frame) = 0;
+            virtual void send_latest(const shared_frame& frame) = 0;
             virtual void send_ping(std::string msg) = 0;
             virtual void send_pong(std::string msg) = 0;
             virtual void close(std::string const& msg = "quit", uint16_t status_code = CloseStatusCode::NormalClosure) = 0;
@@ -10190,6 +10654,7 @@ namespace crow // NOTE: Already documented in "crow/app.h"
                        bool mirror_protocols):
               adaptor_(std::move(adaptor)),
               handler_(handler),
+              max_queued_writes_(handler->websocket_max_queue()),
               max_payload_bytes_(max_payload),
               open_handler_(std::move(open_handler)),
               message_handler_(std::move(message_handler)),
@@ -10322,6 +10787,42 @@ namespace crow // NOTE: Already documented in "crow/app.h"
                 send_data(0x1, std::move(msg));
             }
 
+            /// Send a prebuilt frame, sharing its buffer instead of copying it.
+            void send_frame(const shared_frame& frame) override
+            {
+                auto data = frame.data_;
+                post([this, data]() {
+                    if (!check_queue_limit())
+                        return;
+                    write_buffers_.emplace_back(data);
+                    queued_messages_++;
+                    do_write();
+                });
+            }
+
+            /// Send a frame that supersedes the previous one sent this way, if that one is still queued.
+
+            ///
+            /// Meant for state updates where only the newest matters, so a slow client skips intermediate ones.
+            void send_latest(const shared_frame& frame) override
+            {
+                auto data = frame.data_;
+                post([this, data]() {
+                    if (latest_index_ < write_buffers_.size())
+                    {
+                        write_buffers_.erase(write_buffers_.begin() + latest_index_);
+                        handler_->websocket_stats().conflated++;
+                    }
+                    else if (check_queue_limit())
+                        queued_messages_++;
+                    else
+                        return;
+                    latest_index_ = write_buffers_.size();
+                    write_buffers_.emplace_back(data);
+                    do_write();
+                });
+            }
+
             /// Send a close signal.
 
             ///
@@ -10367,25 +10868,7 @@ namespace crow // NOTE: Already documented in "crow/app.h"
             /// Generate the websocket headers using an opcode and the message size (in bytes).
             std::string build_header(int opcode, size_t size)
             {
-                char buf[2 + 8] = "\x80\x00";
-                buf[0] += opcode;
-                if (size < 126)
-                {
-                    buf[1] += static_cast<char>(size);
-                    return {buf, buf + 2};
-                }
-                else if (size < 0x10000)
-                {
-                    buf[1] += 126;
-                    *(uint16_t*)(buf + 2) = htons(static_cast<uint16_t>(size));
-                    return {buf, buf + 4};
-                }
-                else
-                {
-                    buf[1] += 127;
-                    *reinterpret_cast<uint64_t*>(buf + 2) = ((1 == htonl(1)) ? static_cast<uint64_t>(size) : (static_cast<uint64_t>(htonl((size)&0xFFFFFFFF)) << 32) | htonl(static_cast<uint64_t>(size) >> 32));
-                    return {buf, buf + 10};
-                }
+                return build_frame_header(opcode, size);
             }
 
             /// Send the HTTP upgrade response.
@@ -10790,11 +11273,13 @@ namespace crow // NOTE: Already documented in "crow/app.h"
                 if (sending_buffers_.empty())
                 {
                     sending_buffers_.swap(write_buffers_);
+                    latest_index_ = SIZE_MAX;
+                    queued_messages_ = 0;
                     std::vector<asio::const_buffer> buffers;
                     buffers.reserve(sending_buffers_.size());
                     for (auto& s : sending_buffers_)
                     {
-                        buffers.emplace_back(asio::buffer(s));
+                        buffers.emplace_back(s.buffer());
                     }
                     auto watch = std::weak_ptr<void>{anchor_};
                     asio::async_write(
@@ -10847,11 +11332,38 @@ namespace crow // NOTE: Already documented in "crow/app.h"
                 }
             };
 
+            /// Returns false once the write queue is full, in which case the client is too slow to keep and is disconnected.
+
+            ///
+            /// The limit counts messages waiting behind the write in flight, however many buffers each one takes.
+            bool check_queue_limit()
+            {
+                if (is_slow_consumer_)
+                {
+                    handler_->websocket_stats().dropped++;
+                    return false;
+                }
+                if (queued_messages_ < max_queued_writes_)
+                    return true;
+
+                handler_->websocket_stats().dropped += queued_messages_ + 1;
+                write_buffers_.clear();
+                latest_index_ = SIZE_MAX;
+                queued_messages_ = 0;
+                is_slow_consumer_ = true;
+                CROW_LOG_WARNING << "Websocket client " << this << " is too slow, closing";
+                close("slow consumer", CloseStatusCode::PolicyViolated);
+                return false;
+            }
+
             void send_data_impl(SendMessageType* s)
             {
+                if (!check_queue_limit())
+                    return;
                 auto header = build_header(s->opcode, s->payload.size());
                 write_buffers_.emplace_back(std::move(header));
                 write_buffers_.emplace_back(std::move(s->payload));
+                queued_messages_++;
                 do_write();
             }
 
@@ -10869,8 +11381,36 @@ namespace crow // NOTE: Already documented in "crow/app.h"
             Adaptor adaptor_;
             Handler* handler_;
 
-            std::vector<std::string> sending_buffers_;
-            std::vector<std::string> write_buffers_;
+            /// A queued write, either owned by this connection or shared with others through a \ref shared_frame.
+            struct write_buffer
+            {
+                write_buffer(std::string s):
+                  owned(std::move(s))
+                {}
+
+                write_buffer(const char* s):
+                  owned(s)
+                {}
+
+                write_buffer(std::shared_ptr<const std::string> s):
+                  shared(std::move(s))
+                {}
+
+                asio::const_buffer buffer() const
+                {
+                    return shared ? asio::buffer(*shared) : asio::buffer(owned);
+                }
+
+                std::string owned;
+                std::shared_ptr<const std::string> shared;
+            };
+
+            std::vector<write_buffer> sending_buffers_;
+            std::vector<write_buffer> write_buffers_;
+            size_t max_queued_writes_{SIZE_MAX};
+            size_t queued_messages_{0};     ///< Messages in write_buffers_, the close frame excluded.
+            size_t latest_index_{SIZE_MAX}; ///< Position in write_buffers_ of the frame queued by send_latest().
+            bool is_slow_consumer_{false};  ///< Set once the queue limit was hit, nothing but the close frame is written after that.
 
             std::array<char, 4096> buffer_;
             bool is_binary_;
@@ -10955,9 +11495,10 @@ namespace crow // NOTE: Already documented in "crow/app.h"
              uint16_t concurrency = 1,
              uint8_t timeout = 5,
              typename Adaptor::context* adaptor_ctx = nullptr):
-          acceptor_(io_context_,endpoint),
+          acceptor_(io_context_),
           signals_(io_context_),
           tick_timer_(io_context_),
+          drain_timer_(io_context_),
           handler_(handler),
           concurrency_(concurrency),
           timeout_(timeout),
@@ -10965,7 +11506,22 @@ namespace crow // NOTE: Already documented in "crow/app.h"
           task_queue_length_pool_(concurrency_ - 1),
           middlewares_(middlewares),
           adaptor_ctx_(adaptor_ctx)
-        {}
+        {
+            if (handler->listen_fd() >= 0)
+            {
+                acceptor_.assign(endpoint.protocol(), handler->listen_fd());
+                return;
+            }
+            acceptor_.open(endpoint.protocol());
+            acceptor_.set_option(tcp::acceptor::reuse_address(true));
+#ifdef SO_REUSEPORT
+            // Lets several processes listen on the same port, the kernel spreads connections between them.
+            if (handler->reuse_port())
+                acceptor_.set_option(asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>(true));
+#endif
+            acceptor_.bind(endpoint);
+            acceptor_.listen();
+        }
 
         void set_tick_function(std::chrono::milliseconds d, std::function<void()> f)
         {
@@ -11068,10 +11624,7 @@ namespace crow // NOTE: Already documented in "crow/app.h"
                           << acceptor_.local_endpoint().address() << ":" << acceptor_.local_endpoint().port() << " using " << concurrency_ << " threads";
             CROW_LOG_INFO << "Call `app.loglevel(crow::LogLevel::Warning)` to hide Info level logs.";
 
-            signals_.async_wait(
-              [&](const error_code& /*error*/, int /*signal_number*/) {
-                  stop();
-              });
+            wait_for_signal();
 
             while (worker_thread_count != init_count)
                 std::this_thread::yield();
@@ -11087,7 +11640,28 @@ namespace crow // NOTE: Already documented in "crow/app.h"
               .join();
         }
 
+        /// Stop the server. With a drain timeout set, the first call stops
+        /// accepting and gives open connections that long to finish, a
+        /// second call stops at once. A stop signal repeated within
+        /// repeated_signal_window of the first counts as the same one.
         void stop()
+        {
+            if (handler_->drain_timeout() > 0 && !connection_counts_.draining.exchange(true))
+            {
+                asio::post(io_context_, [this] {
+                    drain();
+                });
+                return;
+            }
+            stop_now();
+        }
+
+        bool draining() const
+        {
+            return connection_counts_.draining;
+        }
+
+        void stop_now()
         {
             shutting_down_ = true; // Prevent the acceptor from taking new connections
             for (auto& io_context : io_context_pool_)
@@ -11129,6 +11703,79 @@ namespace crow // NOTE: Already documented in "crow/app.h"
         }
 
     private:
+        void wait_for_signal()
+        {
+            signals_.async_wait(
+              [this](const error_code& ec, int /*signal_number*/) {
+                  if (ec)
+                      return;
+                  // Through the handler so websockets are closed too. A Ctrl-C reaches the cluster
+                  // master and its workers, and the master then sends its own SIGTERM; only a signal
+                  // sent well after the first one cuts the drain short.
+                  auto now = std::chrono::steady_clock::now();
+                  if (!connection_counts_.draining)
+                  {
+                      first_stop_signal_ = now;
+                      handler_->stop();
+                  }
+                  else if (now - first_stop_signal_ >= repeated_signal_window)
+                  {
+                      CROW_LOG_WARNING << "Stop signal during the drain, stopping now";
+                      handler_->stop();
+                  }
+                  wait_for_signal();
+              });
+        }
+
+        /// Stop accepting, close idle keep-alive connections, answer the requests
+        /// in progress with `Connection: close`, then stop once all connections
+        /// are gone or the drain timeout runs out
+        void drain()
+        {
+            shutting_down_ = true;
+            error_code ec;
+            acceptor_.close(ec); // A listening socket shared with other processes stays open in them
+
+            for (size_t i = 0; i < io_context_pool_.size(); i++)
+            {
+                asio::post(*io_context_pool_[i], [this, i] {
+                    // Connections waiting for a request get one more tick to send it
+                    task_timer_pool_[i]->set_default_timeout(1);
+                    task_timer_pool_[i]->expire_within(1);
+                });
+            }
+
+            drain_started_ = std::chrono::steady_clock::now();
+            drain_completed_from_ = connection_counts_.completed;
+            CROW_LOG_INFO << "Draining " << connection_counts_.open << " connections and " << handler_->websocket_count()
+                          << " websockets, " << connection_counts_.active << " requests in progress";
+            wait_for_drain();
+        }
+
+        void wait_for_drain()
+        {
+            drain_timer_.expires_after(std::chrono::milliseconds(50));
+            drain_timer_.async_wait([this](const error_code& ec) {
+                if (ec)
+                    return;
+                auto elapsed = std::chrono::steady_clock::now() - drain_started_;
+                if ((connection_counts_.open > 0 || handler_->websocket_count() > 0) && elapsed < std::chrono::seconds(handler_->drain_timeout()))
+                {
+                    wait_for_drain();
+                    return;
+                }
+
+                unsigned int cut = connection_counts_.open;
+                LogLevel level = cut > 0 || handler_->websocket_count() > 0 ? LogLevel::Warning : LogLevel::Info;
+                if (logger::get_current_log_level() <= level)
+                    logger(level) << "Drained in " << std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count() << "ms: "
+                                  << connection_counts_.completed - drain_completed_from_ << " requests completed, "
+                                  << cut << " connections cut off (" << connection_counts_.active << " mid-request), "
+                                  << handler_->websocket_count() << " websockets cut off";
+                stop_now();
+            });
+        }
+
         uint16_t pick_io_context_idx()
         {
             uint16_t min_queue_idx = 0;
@@ -11156,7 +11803,8 @@ namespace crow // NOTE: Already documented in "crow/app.h"
 
                 auto p = std::make_shared<Connection<Adaptor, Handler, Middlewares...>>(
                   ic, handler_, server_name_, middlewares_,
-                  get_cached_date_str_pool_[context_idx], *task_timer_pool_[context_idx], adaptor_ctx_, task_queue_length_pool_[context_idx]);
+                  get_cached_date_str_pool_[context_idx], *task_timer_pool_[context_idx], adaptor_ctx_, task_queue_length_pool_[context_idx],
+                  connection_counts_);
 
                 acceptor_.async_accept(
                   p->socket(),
@@ -11197,9 +11845,16 @@ namespace crow // NOTE: Already documented in "crow/app.h"
         std::condition_variable cv_started_;
         std::mutex start_mutex_;
         asio::signal_set signals_;
+        static constexpr std::chrono::seconds repeated_signal_window{1};
+        std::chrono::steady_clock::time_point first_stop_signal_{};
 
         asio::basic_waitable_timer<std::chrono::high_resolution_clock> tick_timer_;
 
+        detail::connection_counts connection_counts_;
+        asio::basic_waitable_timer<std::chrono::steady_clock> drain_timer_;
+        std::chrono::steady_clock::time_point drain_started_;
+        uint64_t drain_completed_from_{};
+
         Handler* handler_;
         uint16_t concurrency_{2};
         std::uint8_t timeout_;
@@ -13073,6 +13728,8 @@ namespace crow // NOTE: Already documented in "crow/app.h"
 
         routing_handle_result find(const std::string& req_url) const
         {
+            if (uint16_t rule_index = find_static(req_url))
+                return routing_handle_result{rule_index, {}, {}};
             return find(req_url, head_);
         }
 
@@ -13160,10 +13817,66 @@ namespace crow // NOTE: Already documented in "crow/app.h"
             if (idx->rule_index)
                 throw std::runtime_error("handler already exists for " + url);
             idx->rule_index = rule_index;
+
+            // Only once the Trie accepted the rule, so a rejected one can't be found through the table
+            add_static(url, rule_index, has_blueprint);
         }
 
     private:
+        /// Look up a parameterless url in the flat table, returns 0 when the full Trie walk is needed.
+        uint16_t find_static(const std::string& req_url) const
+        {
+            if (static_routes_disabled_)
+                return 0;
+
+            auto it = std::lower_bound(static_routes_.begin(), static_routes_.end(), req_url, [](const std::pair<std::string, uint16_t>& entry, const std::string& url) {
+                return entry.first < url;
+            });
+            if (it == static_routes_.end() || it->first != req_url)
+                return 0;
+            return it->second;
+        }
+
+        void add_static(const std::string& url, uint16_t rule_index, bool has_blueprint)
+        {
+            // Blueprint nodes contribute indices along the whole path, which the flat table can't reproduce.
+            if (has_blueprint)
+            {
+                static_routes_disabled_ = true;
+                return;
+            }
+
+            // The walk picks the lowest matching rule index, and a parameterized rule can only match urls
+            // starting with the text before its first parameter. Urls it could shadow are left to the walk.
+            size_t param = url.find('<');
+            if (param != std::string::npos)
+            {
+                std::string prefix = url.substr(0, param);
+                param_prefixes_.emplace_back(prefix, rule_index);
+                static_routes_.erase(std::remove_if(static_routes_.begin(), static_routes_.end(), [&](const std::pair<std::string, uint16_t>& entry) {
+                                         return entry.second > rule_index && entry.first.compare(0, prefix.size(), prefix) == 0;
+                                     }),
+                                     static_routes_.end());
+                return;
+            }
+
+            for (const auto& prefix : param_prefixes_)
+            {
+                if (prefix.second < rule_index && url.compare(0, prefix.first.size(), prefix.first) == 0)
+                    return;
+            }
+
+            auto it = std::lower_bound(static_routes_.begin(), static_routes_.end(), url, [](const std::pair<std::string, uint16_t>& entry, const std::string& key) {
+                return entry.first < key;
+            });
+            if (it == static_routes_.end() || it->first != url)
+                static_routes_.emplace(it, url, rule_index);
+        }
+
         Node head_;
+        std::vector<std::pair<std::string, uint16_t>> static_routes_; ///< Parameterless urls sorted for binary search.
+        std::vector<std::pair<std::string, uint16_t>> param_prefixes_; ///< Text before the first parameter of each parameterized rule.
+        bool static_routes_disabled_{false};
     };
 
     /// A blueprint can be considered a smaller section of a Crow app, specifically where the router is concerned.
@@ -14402,6 +15115,64 @@ namespace crow
             return max_payload_;
         }
 
+        /// \brief Set how many messages a websocket connection may have queued before it is closed as a slow consumer
+        self_t& websocket_max_queue(size_t max_queue)
+        {
+            websocket_max_queue_ = max_queue;
+            return *this;
+        }
+
+        /// \brief Get the websocket write queue limit
+        size_t websocket_max_queue()
+        {
+            return websocket_max_queue_;
+        }
+
+        /// \brief Get the counters of conflated and dropped websocket writes
+        websocket::stats& websocket_stats()
+        {
+            return websocket_stats_;
+        }
+
+        /// \brief Allow other processes to listen on the same port (SO_REUSEPORT, where supported)
+        self_t& reuse_port(bool reuse)
+        {
+            reuse_port_ = reuse;
+            return *this;
+        }
+
+        /// \brief Get whether the listening socket is shared with other processes
+        bool reuse_port()
+        {
+            return reuse_port_;
+        }
+
+        /// \brief Accept on an already listening socket (e.g. one inherited from another process) instead of binding the port
+        self_t& listen_fd(int fd)
+        {
+            listen_fd_ = fd;
+            return *this;
+        }
+
+        /// \brief Get the adopted listening socket, -1 if the server binds its own
+        int listen_fd()
+        {
+            return listen_fd_;
+        }
+
+        /// \brief Set the max HTTP request body size, larger requests are answered with 413 before their body is read
+        self_t& max_body_size(uint64_t max_body_size)
+        {
+            max_body_size_ = max_body_size;
+            return *this;
+        }
+
+        /// \brief Get the max HTTP request body size
+        uint64_t max_body_size()
+        {
+            return max_body_size_;
+        }
+
         self_t& signal_clear()
         {
             signals_.clear();
@@ -14452,6 +15223,19 @@ namespace crow
             return *this;
         }
 
+        /// \brief Set how many seconds stop() waits for open connections to finish (default is 0, stop at once)
+        self_t& drain_timeout(std::uint8_t timeout)
+        {
+            drain_timeout_ = timeout;
+            return *this;
+        }
+
+        /// \brief Get the drain timeout in seconds
+        std::uint8_t drain_timeout()
+        {
+            return drain_timeout_;
+        }
+
         /// \brief Set the server name
         self_t& server_name(std::string server_name)
         {
@@ -14687,7 +15471,11 @@ namespace crow
 #endif
             {
                 // TODO(EDev): Move these 6 lines to a method in http_server.
-                std::vector<crow::websocket::connection*> websockets_to_close = websockets_;
+                std::vector<crow::websocket::connection*> websockets_to_close;
+                {
+                    std::lock_guard<std::mutex> lock(websockets_mutex_);
+                    websockets_to_close = websockets_;
+                }
                 for (auto websocket : websockets_to_close)
                 {
                     CROW_LOG_INFO << "Quitting Websocket: " << websocket;
@@ -14699,14 +15487,33 @@ namespace crow
 
         void add_websocket(crow::websocket::connection* conn)
         {
+            std::lock_guard<std::mutex> lock(websockets_mutex_);
             websockets_.push_back(conn);
         }
 
         void remove_websocket(crow::websocket::connection* conn)
         {
+            std::lock_guard<std::mutex> lock(websockets_mutex_);
             websockets_.erase(std::remove(websockets_.begin(), websockets_.end(), conn), websockets_.end());
         }
 
+        /// \brief Number of open websocket connections, safe to call from any thread
+        size_t websocket_count()
+        {
+            std::lock_guard<std::mutex> lock(websockets_mutex_);
+            return websockets_.size();
+        }
+
+        /// \brief Whether stop() was called and the server is waiting for open connections to finish
+        bool draining()
+        {
+#ifdef CROW_ENABLE_SSL
+            if (ssl_used_)
+                return ssl_server_ && ssl_server_->draining();
+#endif
+            return server_ && server_->draining();
+        }
+
         /// \brief Print the routing paths defined for each HTTP method
         void debug_print()
         {
@@ -14881,9 +15688,15 @@ namespace crow
 
     private:
         std::uint8_t timeout_{5};
+        std::uint8_t drain_timeout_{0};
         uint16_t port_ = 80;
         uint16_t concurrency_ = 2;
         uint64_t max_payload_{UINT64_MAX};
+        uint64_t max_body_size_{UINT64_MAX};
+        size_t websocket_max_queue_{SIZE_MAX};
+        bool reuse_port_{false};
+        int listen_fd_{-1};
+        websocket::stats websocket_stats_;
         std::string server_name_ = std::string("Crow/") + VERSION;
         std::string bindaddr_ = "0.0.0.0";
         size_t res_stream_threshold_ = 1048576;
@@ -14913,6 +15726,7 @@ namespace crow
         bool server_started_{false};
         std::condition_variable cv_started_;
         std::mutex start_mutex_;
+        std::mutex websockets_mutex_; ///< Connections are added and removed from every io thread
         std::vector<crow::websocket::connection*> websockets_;
     };
 
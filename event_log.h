@@ -0,0 +1,492 @@
+#pragma once
+
+#include "crow_all.h"
+#include "gossip.h"
+#include "shared_state.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <istream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// Line protocol shared by the event log leader and its clients. Names go
+// last on a line so they may contain spaces; newlines in them become spaces.
+//   client -> leader:  follow <next seq>             stream the log from there
+//                      click <0|1> <value> <time> <name>   append a click
+//                      ack <next seq>                everything before it is applied
+//   leader -> client:  from <seq>                    where the stream starts
+//                      ev <seq> <0|1> <value> <time> <name>
+// With a shared secret a client starts every connection with
+//                      hello <secret>
+// and the leader closes a connection that doesn't before taking anything else.
+// A side that receives a line longer than maxLineLength drops the connection.
+namespace event_log_detail {
+    constexpr size_t maxLineLength = 8192;
+
+    inline void appendName(std::string& out, std::string_view name) {
+        for (char c : name) {
+            out.push_back(c == '\n' || c == '\r' ? ' ' : c);
+        }
+        out.push_back('\n');
+    }
+
+    // Whether another complete line is already buffered
+    inline bool hasLine(const crow::asio::streambuf& buffer) {
+        auto data = buffer.data();
+        return std::find(crow::asio::buffers_begin(data), crow::asio::buffers_end(data), '\n') != crow::asio::buffers_end(data);
+    }
+
+    // Splits off the name, the rest of the line after the given number of fields
+    inline bool splitName(const std::string& line, int fields, std::string& head, std::string& name) {
+        size_t pos = 0;
+        for (int i = 0; i < fields; ++i) {
+            pos = line.find(' ', pos);
+            if (pos == std::string::npos) return false;
+            ++pos;
+        }
+        head = line.substr(0, pos);
+        name = line.substr(pos);
+        return true;
+    }
+}
+
+// Keeps the authoritative order of click events for all nodes. Clicks are
+// appended locally or submitted by clients, numbered, put in this node's
+// event ring, and shipped to following clients in batches of up to
+// maxBatch events per write. A client acknowledges what it has applied and
+// at most window events are ever in flight to it; a client that reconnects
+// resumes from its acknowledged position while that is still in the log.
+class EventLogLeader {
+public:
+    static constexpr size_t logCapacity = 65536;
+    static constexpr uint64_t maxBatch = 512;
+    static constexpr uint64_t window = 4096;
+
+    std::atomic<uint64_t> shipped{0}; // Events written to followers, for stats
+
+    // Called for every event in log order, right after it reaches the event
+    // ring; the leader runs it outside the log lock, one event at a time
+    using EventHandler = std::function<void(std::string_view name, bool increment, int value, int64_t time)>;
+
+private:
+    struct Entry {
+        std::string name;
+        bool increment;
+        int value;
+        int64_t time;
+    };
+
+    struct Session {
+        Session(crow::asio::io_context& io, bool authenticated) :
+            socket(io), buffer(event_log_detail::maxLineLength), authenticated(authenticated) {}
+
+        crow::tcp::socket socket;
+        crow::asio::streambuf buffer;
+        bool authenticated;
+        bool following = false;
+        bool writing = false;
+        uint64_t next = 0;  // Next sequence number to send
+        uint64_t acked = 0; // Everything before this has been applied by the client
+        std::string outgoing;
+    };
+
+    GameState& state;
+    std::string secret;
+    crow::asio::io_context io;
+    crow::tcp::acceptor acceptor;
+    std::vector<std::shared_ptr<Session>> sessions;
+    std::atomic<bool> flushScheduled{false};
+    std::thread thread;
+    EventHandler onEvent;
+
+    std::mutex logMutex;
+    std::deque<Entry> log;
+    uint64_t firstSeq;
+    uint64_t nextSeq;
+
+    // Hands the event handler from one append to the next in log order
+    std::mutex handlerMutex;
+    std::condition_variable handlerTurn;
+    uint64_t handlerSeq; // Sequence number of the next event to hand to onEvent
+
+    void accept() {
+        auto session = std::make_shared<Session>(io, secret.empty());
+        acceptor.async_accept(session->socket, [this, session](const crow::error_code& ec) {
+            if (ec) return;
+            session->socket.set_option(crow::tcp::no_delay(true));
+            sessions.push_back(session);
+            read(session);
+            accept();
+        });
+    }
+
+    void drop(const std::shared_ptr<Session>& session) {
+        crow::error_code ec;
+        session->socket.close(ec);
+        sessions.erase(std::remove(sessions.begin(), sessions.end(), session), sessions.end());
+    }
+
+    void read(std::shared_ptr<Session> session) {
+        crow::asio::async_read_until(session->socket, session->buffer, '\n', [this, session](const crow::error_code& ec, size_t) {
+            if (ec) {
+                drop(session);
+                return;
+            }
+            // Take every complete line already received before writing anything back
+            std::istream input(&session->buffer);
+            std::string line;
+            do {
+                std::getline(input, line);
+                if (!handleLine(session, line)) {
+                    CROW_LOG_WARNING << "Event log: closing a connection without the shared secret";
+                    drop(session);
+                    return;
+                }
+            } while (event_log_detail::hasLine(session->buffer));
+            flush(session);
+            read(session);
+        });
+    }
+
+    // False if the connection has to be closed
+    bool handleLine(const std::shared_ptr<Session>& session, const std::string& line) {
+        std::string head, name;
+        std::istringstream fields(line);
+        std::string kind;
+        fields >> kind;
+
+        if (!session->authenticated) {
+            std::string given;
+            if (kind != "hello" || !(fields >> given) || !GossipNode::matches(given, secret)) return false;
+            session->authenticated = true;
+        } else if (kind == "click" && event_log_detail::splitName(line, 4, head, name)) {
+            std::istringstream values(head);
+            int increment, value;
+            int64_t time;
+            if (values >> kind >> increment >> value >> time) {
+                append(name, increment != 0, value, time);
+            }
+        } else if (kind == "ack") {
+            uint64_t seq;
+            if (fields >> seq && seq <= session->next) {
+                session->acked = std::max(session->acked, seq);
+            }
+        } else if (kind == "follow") {
+            uint64_t seq;
+            if (!(fields >> seq)) return true;
+            {
+                std::lock_guard<std::mutex> lock(logMutex);
+                // A position outside the log means the client is too far behind or
+                // followed a leader that has since lost its log; both restart from the oldest entry
+                session->next = seq >= firstSeq && seq <= nextSeq ? seq : firstSeq;
+            }
+            session->acked = session->next;
+            session->following = true;
+            session->outgoing = "from " + std::to_string(session->next) + "\n";
+            write(session);
+        }
+        return true;
+    }
+
+    // Queues the next batch for one client unless a write is already in flight
+    void flush(const std::shared_ptr<Session>& session) {
+        if (!session->following || session->writing) return;
+
+        std::string out;
+        {
+            std::lock_guard<std::mutex> lock(logMutex);
+            if (session->next < firstSeq) {
+                // Fell out of the log while waiting for acks, skip ahead
+                session->next = session->acked = firstSeq;
+            }
+            uint64_t end = std::min({nextSeq, session->next + maxBatch, session->acked + window});
+            for (uint64_t seq = session->next; seq < end; ++seq) {
+                const Entry& entry = log[seq - firstSeq];
+                out += "ev " + std::to_string(seq) + ' ' + (entry.increment ? '1' : '0') + ' ' + std::to_string(entry.value) + ' ' +
+                       std::to_string(entry.time) + ' ';
+                event_log_detail::appendName(out, entry.name);
+            }
+            shipped.fetch_add(end - std::min(end, session->next), std::memory_order_relaxed);
+            session->next = std::max(session->next, end);
+        }
+        if (out.empty()) return;
+
+        session->outgoing = std::move(out);
+        write(session);
+    }
+
+    void write(std::shared_ptr<Session> session) {
+        session->writing = true;
+        crow::asio::async_write(session->socket, crow::asio::buffer(session->outgoing), [this, session](const crow::error_code& ec, size_t) {
+            session->writing = false;
+            if (ec) {
+                drop(session);
+                return;
+            }
+            flush(session);
+        });
+    }
+
+    void scheduleFlush() {
+        // One pending flush picks up everything appended before it runs
+        if (flushScheduled.exchange(true)) return;
+        crow::asio::post(io, [this]() {
+            flushScheduled = false;
+            for (auto session : std::vector<std::shared_ptr<Session>>(sessions)) {
+                flush(session);
+            }
+        });
+    }
+
+public:
+    // Listens on endpoint, which should be an interface only the other nodes
+    // reach; an empty secret takes clicks from any client that connects
+    EventLogLeader(GameState& state, const crow::tcp::endpoint& endpoint, std::string secret) :
+        state(state), secret(std::move(secret)), acceptor(io) {
+        // Shared with the instance taking over during an upgrade
+        acceptor.open(endpoint.protocol());
+        acceptor.set_option(crow::tcp::acceptor::reuse_address(true));
+        acceptor.set_option(crow::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>(true));
+        acceptor.bind(endpoint);
+        acceptor.listen();
+
+        // A restarted leader worker continues the numbering; the entries themselves are gone
+        firstSeq = nextSeq = handlerSeq = state.replicatedSeq.load();
+    }
+
+    ~EventLogLeader() {
+        stop();
+    }
+
+    // Adds a click to the log and to this node's event ring, in log order
+    void append(std::string_view name, bool increment, int value, int64_t time = 0) {
+        if (time == 0) time = static_cast<int64_t>(std::time(nullptr));
+        uint64_t seq;
+        {
+            std::lock_guard<std::mutex> lock(logMutex);
+            seq = nextSeq++;
+            log.push_back(Entry{std::string(name), increment, value, time});
+            if (log.size() > logCapacity) {
+                log.pop_front();
+                ++firstSeq;
+            }
+            state.appendEvent(name, increment, value, GameState::replicatedWorker, time);
+            state.replicatedSeq.store(nextSeq);
+        }
+        scheduleFlush();
+
+        if (!onEvent) return;
+        std::unique_lock<std::mutex> lock(handlerMutex);
+        handlerTurn.wait(lock, [this, seq]() {
+            return handlerSeq == seq;
+        });
+        lock.unlock();
+        onEvent(name, increment, value, time);
+        lock.lock();
+        ++handlerSeq;
+        handlerTurn.notify_all();
+    }
+
+    // Must be set before start
+    void setEventHandler(EventHandler handler) {
+        onEvent = std::move(handler);
+    }
+
+    void start() {
+        accept();
+        thread = std::thread([this]() {
+            io.run();
+        });
+    }
+
+    void stop() {
+        io.stop();
+        if (thread.joinable()) thread.join();
+    }
+};
+
+// Connection from a worker to the event log leader. Every client submits
+// its worker's clicks; a following client also applies the leader's stream
+// to the node's event ring and acknowledges it. Clicks made while the
+// leader is unreachable are held, up to maxPending, and sent on reconnect.
+class EventLogClient {
+public:
+    static constexpr size_t maxPending = 65536;
+
+    std::atomic<uint64_t> applied{0}; // Events taken from the leader, for stats
+
+    using EventHandler = EventLogLeader::EventHandler;
+
+private:
+    GameState& state;
+    crow::tcp::endpoint leader;
+    std::string secret;
+    bool following;
+    crow::asio::io_context io;
+    crow::tcp::socket socket;
+    crow::asio::streambuf buffer;
+    crow::asio::steady_timer retryTimer;
+    std::thread thread;
+    EventHandler onEvent;
+
+    bool connected = false;
+    bool writing = false;
+    uint64_t expected = 0; // Next sequence number to apply
+    std::string outgoing;
+
+    std::mutex pendingMutex;
+    std::deque<std::string> pending; // Lines waiting for the connection
+
+    void connect() {
+        socket = crow::tcp::socket(io);
+        socket.async_connect(leader, [this](const crow::error_code& ec) {
+            if (ec) {
+                retry();
+                return;
+            }
+            connected = true;
+            socket.set_option(crow::tcp::no_delay(true));
+            if (following) {
+                expected = state.replicatedSeq.load();
+                std::lock_guard<std::mutex> lock(pendingMutex);
+                pending.push_front("follow " + std::to_string(expected) + "\n");
+            }
+            if (!secret.empty()) {
+                std::lock_guard<std::mutex> lock(pendingMutex);
+                pending.push_front("hello " + secret + "\n");
+            }
+            read();
+            flush();
+        });
+    }
+
+    void retry() {
+        connected = false;
+        writing = false;
+        buffer.consume(buffer.size());
+        crow::error_code ec;
+        socket.close(ec);
+        retryTimer.expires_after(std::chrono::milliseconds(500));
+        retryTimer.async_wait([this](const crow::error_code& ec) {
+            if (!ec) connect();
+        });
+    }
+
+    void read() {
+        crow::asio::async_read_until(socket, buffer, '\n', [this](const crow::error_code& ec, size_t) {
+            if (ec) {
+                if (connected) retry();
+                return;
+            }
+            std::istream input(&buffer);
+            std::string line;
+            do {
+                std::getline(input, line);
+                handleLine(line);
+            } while (event_log_detail::hasLine(buffer));
+
+            // One ack per batch read, not per event
+            if (following) {
+                std::lock_guard<std::mutex> lock(pendingMutex);
+                pending.push_back("ack " + std::to_string(expected) + "\n");
+            }
+            flush();
+            read();
+        });
+    }
+
+    void handleLine(const std::string& line) {
+        std::string head, name;
+        std::istringstream fields(line);
+        std::string kind;
+        fields >> kind;
+
+        if (kind == "from") {
+            fields >> expected;
+        } else if (kind == "ev" && event_log_detail::splitName(line, 5, head, name)) {
+            std::istringstream values(head);
+            uint64_t seq;
+            int increment, value;
+            int64_t time;
+            if (!(values >> kind >> seq >> increment >> value >> time) || seq != expected) return;
+            state.appendEvent(name, increment != 0, value, GameState::replicatedWorker, time);
+            state.replicatedSeq.store(++expected);
+            if (onEvent) onEvent(name, increment != 0, value, time);
+            applied.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    void flush() {
+        if (!connected || writing) return;
+        {
+            std::lock_guard<std::mutex> lock(pendingMutex);
+            if (pending.empty()) return;
+            outgoing.clear();
+            while (!pending.empty()) {
+                outgoing += pending.front();
+                pending.pop_front();
+            }
+        }
+        writing = true;
+        crow::asio::async_write(socket, crow::asio::buffer(outgoing), [this](const crow::error_code& ec, size_t) {
+            writing = false;
+            if (ec) {
+                // Lines in a failed write may or may not have arrived; they are not resent
+                if (connected) retry();
+                return;
+            }
+            flush();
+        });
+    }
+
+public:
+    EventLogClient(GameState& state, const crow::tcp::endpoint& leader, std::string secret, bool following) :
+        state(state), leader(leader), secret(std::move(secret)), following(following), socket(io), buffer(event_log_detail::maxLineLength), retryTimer(io) {}
+
+    ~EventLogClient() {
+        stop();
+    }
+
+    // Sends a click to the leader; it shows up in the event ring once the leader has ordered it
+    void submit(std::string_view name, bool increment, int value) {
+        std::string line = "click " + std::string(increment ? "1" : "0") + ' ' + std::to_string(value) + ' ' +
+                           std::to_string(static_cast<int64_t>(std::time(nullptr))) + ' ';
+        event_log_detail::appendName(line, name);
+        {
+            std::lock_guard<std::mutex> lock(pendingMutex);
+            if (pending.size() >= maxPending) return;
+            pending.push_back(std::move(line));
+        }
+        crow::asio::post(io, [this]() {
+            flush();
+        });
+    }
+
+    // Must be set before start; only following clients see events
+    void setEventHandler(EventHandler handler) {
+        onEvent = std::move(handler);
+    }
+
+    void start() {
+        connect();
+        thread = std::thread([this]() {
+            io.run();
+        });
+    }
+
+    void stop() {
+        io.stop();
+        if (thread.joinable()) thread.join();
+    }
+};
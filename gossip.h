@@ -0,0 +1,194 @@
+#pragma once
+
+#include "crow_all.h"
+#include "shared_state.h"
+
+#include <chrono>
+#include <cstdint>
+#include <istream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+// Replicates the counter between nodes as a PN-counter. Every interval the
+// node sends each peer all the tallies it knows, one line per node:
+//   pn <node id> <plus clicks> <minus clicks>
+// and merges whatever its peers send back. Merging is a per-node max, so
+// messages may be lost, repeated or reordered and the nodes still converge.
+// With a shared secret every connection starts with
+//   hello <secret>
+// and a connection that doesn't is closed before any tally is merged.
+class GossipNode {
+public:
+    static constexpr size_t maxLineLength = 256;
+
+private:
+    struct Peer {
+        crow::tcp::endpoint endpoint;
+        std::unique_ptr<crow::tcp::socket> socket;
+        bool connected = false;
+        bool greeted = false; // Sent the hello line on this connection
+        bool busy = false;    // Connecting or writing
+        std::string outgoing;
+    };
+
+    struct Session {
+        Session(crow::asio::io_context& io, bool authenticated) : socket(io), buffer(maxLineLength), authenticated(authenticated) {}
+
+        crow::tcp::socket socket;
+        crow::asio::streambuf buffer; // A longer line fails the read and ends the session
+        bool authenticated;
+    };
+
+    GameState& state;
+    uint64_t nodeId;
+    std::string secret;
+    std::unordered_set<uint64_t> rejectedNodes; // Nodes already logged as not fitting
+    std::chrono::milliseconds interval;
+    crow::asio::io_context io;
+    crow::tcp::acceptor acceptor;
+    crow::asio::steady_timer timer;
+    std::vector<Peer> peers;
+    std::thread thread;
+
+    std::string encodeState() {
+        std::ostringstream out;
+        out << "pn " << nodeId << ' ' << state.plusClicks.load() << ' ' << state.minusClicks.load() << '\n';
+        for (const auto& tally : state.remoteTallies) {
+            uint64_t node = tally.node.load();
+            if (node != 0) {
+                out << "pn " << node << ' ' << tally.plus.load() << ' ' << tally.minus.load() << '\n';
+            }
+        }
+        return out.str();
+    }
+
+    void accept() {
+        auto session = std::make_shared<Session>(io, secret.empty());
+        acceptor.async_accept(session->socket, [this, session](const crow::error_code& ec) {
+            if (ec) return;
+            read(session);
+            accept();
+        });
+    }
+
+    void read(std::shared_ptr<Session> session) {
+        crow::asio::async_read_until(session->socket, session->buffer, '\n', [this, session](const crow::error_code& ec, size_t) {
+            if (ec) return;
+            std::istream input(&session->buffer);
+            std::string line;
+            std::getline(input, line);
+
+            std::istringstream fields(line);
+            std::string kind;
+            if (!session->authenticated) {
+                std::string given;
+                if (!(fields >> kind >> given) || kind != "hello" || !matches(given, secret)) {
+                    CROW_LOG_WARNING << "Gossip: closing a connection without the shared secret";
+                    return;
+                }
+                session->authenticated = true;
+                read(session);
+                return;
+            }
+
+            uint64_t node, plus, minus;
+            if (fields >> kind >> node >> plus >> minus && kind == "pn") {
+                if (!state.mergeTally(nodeId, node, plus, minus) && node != 0 && rejectedNodes.size() < GameState::maxNodes &&
+                    rejectedNodes.insert(node).second) {
+                    CROW_LOG_WARNING << "Gossip: no room for node " << node << ", only " << GameState::maxNodes
+                                     << " nodes are tracked; its clicks are left out of the counter";
+                }
+            }
+            read(session);
+        });
+    }
+
+    void send(Peer& peer, const std::string& message) {
+        if (peer.busy) return;
+        peer.busy = true;
+
+        if (!peer.connected) {
+            peer.socket = std::make_unique<crow::tcp::socket>(io);
+            peer.socket->async_connect(peer.endpoint, [this, &peer](const crow::error_code& ec) {
+                peer.busy = false;
+                peer.connected = !ec;
+                peer.greeted = false;
+            });
+            return;
+        }
+
+        peer.outgoing.clear();
+        if (!peer.greeted && !secret.empty()) {
+            peer.outgoing = "hello " + secret + '\n';
+        }
+        peer.greeted = true;
+        peer.outgoing += message;
+        crow::asio::async_write(*peer.socket, crow::asio::buffer(peer.outgoing), [&peer](const crow::error_code& ec, size_t) {
+            peer.busy = false;
+            if (ec) {
+                // Reconnect on the next round
+                peer.connected = false;
+            }
+        });
+    }
+
+    void tick() {
+        std::string message = encodeState();
+        for (auto& peer : peers) {
+            send(peer, message);
+        }
+        timer.expires_after(interval);
+        timer.async_wait([this](const crow::error_code& ec) {
+            if (!ec) tick();
+        });
+    }
+
+public:
+    // Compares a non-empty secret in time independent of where the first difference is
+    static bool matches(const std::string& given, const std::string& expected) {
+        unsigned char difference = given.size() != expected.size();
+        for (size_t i = 0; i < given.size(); ++i) {
+            difference |= static_cast<unsigned char>(given[i] ^ expected[i % expected.size()]);
+        }
+        return difference == 0;
+    }
+
+    // Listens on endpoint, which should be an interface only the other nodes
+    // reach; an empty secret accepts tallies from any client that connects
+    GossipNode(GameState& state, uint64_t nodeId, const crow::tcp::endpoint& endpoint, const std::vector<crow::tcp::endpoint>& peerEndpoints,
+               std::string secret, std::chrono::milliseconds interval = std::chrono::milliseconds(200)) :
+        state(state), nodeId(nodeId), secret(std::move(secret)), interval(interval), acceptor(io), timer(io) {
+        // Shared with the instance taking over during an upgrade
+        acceptor.open(endpoint.protocol());
+        acceptor.set_option(crow::tcp::acceptor::reuse_address(true));
+        acceptor.set_option(crow::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>(true));
+        acceptor.bind(endpoint);
+        acceptor.listen();
+
+        for (const auto& endpoint : peerEndpoints) {
+            peers.emplace_back();
+            peers.back().endpoint = endpoint;
+        }
+    }
+
+    ~GossipNode() {
+        stop();
+    }
+
+    void start() {
+        accept();
+        tick();
+        thread = std::thread([this]() {
+            io.run();
+        });
+    }
+
+    void stop() {
+        io.stop();
+        if (thread.joinable()) thread.join();
+    }
+};
@@ -0,0 +1,492 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Append-only store of every click, one directory per writing worker:
+//   players           player names, one per line; the line number is the player id
+//   <seg>.time        int64 unix time
+//   <seg>.player      uint32 player id
+//   <seg>.team        uint8 1 plus, 0 minus
+//   <seg>.value       int32 counter value
+//   <seg>.index       int64 min and max time of every complete block of blockSize rows
+//   segments          uint64 segment, int64 min time, int64 max time for every full segment
+// The time, player, team and value files are the columns of a segment: row
+// i of the segment is entry i of each of them. A segment holds
+// segmentCapacity rows. Rows become visible once all their columns are
+// written, so readers in other processes use the shortest column.
+// Queries skip whole segments and then whole blocks by time, reading only
+// the columns of the blocks that can match.
+class HistoryStore {
+public:
+    static constexpr uint64_t segmentCapacity = 1 << 22;
+    static constexpr uint64_t blockSize = 4096;
+    static constexpr size_t flushThreshold = 4096;
+
+    struct Record {
+        int64_t time;
+        std::string player;
+        bool increment;
+        int value;
+    };
+
+private:
+    struct TimeRange {
+        int64_t min;
+        int64_t max;
+    };
+
+    // Where a scan of one worker directory continues
+    struct Position {
+        uint64_t segment = 0;
+        uint64_t row = 0;
+    };
+
+    // Append descriptors of the segment being written, kept open between flushes
+    struct SegmentFiles {
+        int time = -1;
+        int player = -1;
+        int team = -1;
+        int value = -1;
+        int index = -1;
+    };
+
+    // Player names of one worker directory, read incrementally as it grows
+    struct PlayerNames {
+        std::vector<std::string> names;
+        off_t offset = 0;
+    };
+
+    std::filesystem::path root;
+    std::filesystem::path directory;
+    std::mutex mutex;      // Writer state
+    std::mutex readMutex;  // Reader cache
+
+    // Writer state
+    std::unordered_map<std::string, uint32_t> playerIds;
+    uint64_t segment = 0;
+    uint64_t rows = 0; // Rows written to the current segment
+    TimeRange block{INT64_MAX, INT64_MIN};
+    TimeRange segmentRange{INT64_MAX, INT64_MIN};
+    std::vector<int64_t> pendingTimes;
+    std::vector<uint32_t> pendingPlayers;
+    std::vector<uint8_t> pendingTeams;
+    std::vector<int32_t> pendingValues;
+    std::string pendingNames;
+    int playersFile = -1;
+    SegmentFiles files;
+
+    // Reader cache, keyed by worker directory
+    std::map<std::string, PlayerNames> namesCache;
+
+    static std::string segmentPath(const std::filesystem::path& dir, uint64_t segment, const char* column) {
+        char name[32];
+        std::snprintf(name, sizeof(name), "%08llu.%s", static_cast<unsigned long long>(segment), column);
+        return (dir / name).string();
+    }
+
+    static off_t fileSize(const std::string& path) {
+        struct stat info;
+        return stat(path.c_str(), &info) == 0 ? info.st_size : 0;
+    }
+
+    static int openAppend(const std::string& path) {
+        int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (fd < 0) throw std::runtime_error("cannot open " + path);
+        return fd;
+    }
+
+    static void writeAll(int fd, const void* data, size_t size) {
+        const char* bytes = static_cast<const char*>(data);
+        while (size > 0) {
+            ssize_t written = ::write(fd, bytes, size);
+            if (written <= 0) throw std::runtime_error("cannot write history");
+            bytes += written;
+            size -= written;
+        }
+    }
+
+    static void appendFile(const std::string& path, const void* data, size_t size) {
+        if (size == 0) return;
+        int fd = openAppend(path);
+        try {
+            writeAll(fd, data, size);
+        } catch (...) {
+            ::close(fd);
+            throw;
+        }
+        ::close(fd);
+    }
+
+    static void closeFile(int& fd) {
+        if (fd >= 0) ::close(fd);
+        fd = -1;
+    }
+
+    void openSegment() {
+        closeSegment();
+        files.time = openAppend(segmentPath(directory, segment, "time"));
+        files.player = openAppend(segmentPath(directory, segment, "player"));
+        files.team = openAppend(segmentPath(directory, segment, "team"));
+        files.value = openAppend(segmentPath(directory, segment, "value"));
+        files.index = openAppend(segmentPath(directory, segment, "index"));
+    }
+
+    void closeSegment() {
+        closeFile(files.time);
+        closeFile(files.player);
+        closeFile(files.team);
+        closeFile(files.value);
+        closeFile(files.index);
+    }
+
+    template<typename T>
+    static std::vector<T> readColumn(const std::string& path, uint64_t first, uint64_t count) {
+        std::vector<T> values(count);
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return {};
+        ssize_t size = ::pread(fd, values.data(), count * sizeof(T), first * sizeof(T));
+        ::close(fd);
+        values.resize(size > 0 ? size / sizeof(T) : 0);
+        return values;
+    }
+
+    // Rows present in every column of a segment
+    static uint64_t segmentRows(const std::filesystem::path& dir, uint64_t segment) {
+        return std::min({fileSize(segmentPath(dir, segment, "time")) / sizeof(int64_t),
+                         fileSize(segmentPath(dir, segment, "player")) / sizeof(uint32_t),
+                         fileSize(segmentPath(dir, segment, "team")) / sizeof(uint8_t),
+                         fileSize(segmentPath(dir, segment, "value")) / sizeof(int32_t)});
+    }
+
+    static std::vector<uint64_t> listSegments(const std::filesystem::path& dir) {
+        std::vector<uint64_t> segments;
+        std::error_code ec;
+        for (const auto& entry : std::filesystem::directory_iterator(dir, ec)) {
+            if (entry.path().extension() == ".time") {
+                segments.push_back(std::stoull(entry.path().stem().string()));
+            }
+        }
+        std::sort(segments.begin(), segments.end());
+        return segments;
+    }
+
+    static void widen(TimeRange& range, int64_t time) {
+        range.min = std::min(range.min, time);
+        range.max = std::max(range.max, time);
+    }
+
+    static TimeRange rangeOf(const std::vector<int64_t>& times) {
+        TimeRange range{INT64_MAX, INT64_MIN};
+        for (int64_t time : times) widen(range, time);
+        return range;
+    }
+
+    // Picks up where a previous run stopped, cutting off rows a crash left half-written
+    void recover() {
+        std::filesystem::create_directories(directory);
+
+        std::string playersPath = (directory / "players").string();
+        std::string names = readAll(playersPath);
+        size_t complete = names.rfind('\n') + 1; // 0 when there is no newline at all
+        ::truncate(playersPath.c_str(), complete);
+        for (size_t start = 0; start < complete;) {
+            size_t end = names.find('\n', start);
+            playerIds.emplace(names.substr(start, end - start), static_cast<uint32_t>(playerIds.size()));
+            start = end + 1;
+        }
+
+        auto segments = listSegments(directory);
+        if (segments.empty()) return;
+        segment = segments.back();
+        rows = segmentRows(directory, segment);
+        ::truncate(segmentPath(directory, segment, "time").c_str(), rows * sizeof(int64_t));
+        ::truncate(segmentPath(directory, segment, "player").c_str(), rows * sizeof(uint32_t));
+        ::truncate(segmentPath(directory, segment, "team").c_str(), rows * sizeof(uint8_t));
+        ::truncate(segmentPath(directory, segment, "value").c_str(), rows * sizeof(int32_t));
+
+        // Rebuild the block index from the time column if a crash left it short
+        std::string indexPath = segmentPath(directory, segment, "index");
+        uint64_t blocks = rows / blockSize;
+        uint64_t indexed = std::min<uint64_t>(fileSize(indexPath) / sizeof(TimeRange), blocks);
+        ::truncate(indexPath.c_str(), indexed * sizeof(TimeRange));
+        for (auto range : readColumn<TimeRange>(indexPath, 0, indexed)) {
+            widen(segmentRange, range.min);
+            widen(segmentRange, range.max);
+        }
+        for (uint64_t b = indexed; b < blocks; ++b) {
+            TimeRange range = rangeOf(readColumn<int64_t>(segmentPath(directory, segment, "time"), b * blockSize, blockSize));
+            appendFile(indexPath, &range, sizeof(range));
+            widen(segmentRange, range.min);
+            widen(segmentRange, range.max);
+        }
+        block = rangeOf(readColumn<int64_t>(segmentPath(directory, segment, "time"), blocks * blockSize, rows - blocks * blockSize));
+        if (rows > blocks * blockSize) {
+            widen(segmentRange, block.min);
+            widen(segmentRange, block.max);
+        }
+
+        if (rows == segmentCapacity) {
+            sealSegment();
+        }
+    }
+
+    static std::string readAll(const std::string& path, off_t offset = 0) {
+        std::string data;
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return data;
+        char buffer[65536];
+        ssize_t size;
+        while ((size = ::pread(fd, buffer, sizeof(buffer), offset)) > 0) {
+            data.append(buffer, size);
+            offset += size;
+        }
+        ::close(fd);
+        return data;
+    }
+
+    void sealSegment() {
+        struct {
+            uint64_t segment;
+            TimeRange range;
+        } entry{segment, segmentRange};
+        appendFile((directory / "segments").string(), &entry, sizeof(entry));
+        ++segment;
+        rows = 0;
+        block = segmentRange = TimeRange{INT64_MAX, INT64_MIN};
+        if (files.time >= 0) openSegment();
+    }
+
+    // Writes up to the end of the current segment; returns how many pending rows it took
+    size_t flushSegment(size_t first) {
+        size_t count = std::min<uint64_t>(pendingTimes.size() - first, segmentCapacity - rows);
+        writeAll(files.time, pendingTimes.data() + first, count * sizeof(int64_t));
+        writeAll(files.player, pendingPlayers.data() + first, count * sizeof(uint32_t));
+        writeAll(files.team, pendingTeams.data() + first, count * sizeof(uint8_t));
+        writeAll(files.value, pendingValues.data() + first, count * sizeof(int32_t));
+
+        for (size_t i = first; i < first + count; ++i) {
+            widen(block, pendingTimes[i]);
+            widen(segmentRange, pendingTimes[i]);
+            if (++rows % blockSize == 0) {
+                writeAll(files.index, &block, sizeof(block));
+                block = TimeRange{INT64_MAX, INT64_MIN};
+            }
+        }
+        if (rows == segmentCapacity) {
+            sealSegment();
+        }
+        return count;
+    }
+
+    void flushLocked() {
+        if (pendingTimes.empty()) return;
+        // Names first, so every id a reader finds in a column resolves
+        writeAll(playersFile, pendingNames.data(), pendingNames.size());
+        pendingNames.clear();
+        for (size_t done = 0; done < pendingTimes.size();) {
+            done += flushSegment(done);
+        }
+        pendingTimes.clear();
+        pendingPlayers.clear();
+        pendingTeams.clear();
+        pendingValues.clear();
+    }
+
+    const std::vector<std::string>& playerNames(const std::filesystem::path& dir) {
+        PlayerNames& cache = namesCache[dir.string()];
+        std::string data = readAll((dir / "players").string(), cache.offset);
+        size_t complete = data.rfind('\n') + 1;
+        for (size_t start = 0; start < complete;) {
+            size_t end = data.find('\n', start);
+            cache.names.push_back(data.substr(start, end - start));
+            start = end + 1;
+        }
+        cache.offset += complete;
+        return cache.names;
+    }
+
+    // Appends matching rows of one worker directory in row order, starting at
+    // start and stopping after limit; positions gets the row after each one
+    void scan(const std::filesystem::path& dir, int64_t from, int64_t to, size_t limit, Position start, std::vector<Record>& out,
+              std::vector<Position>& positions) {
+        std::map<uint64_t, TimeRange> sealed;
+        struct {
+            uint64_t segment;
+            TimeRange range;
+        } entry;
+        std::string summary = readAll((dir / "segments").string());
+        for (size_t pos = 0; pos + sizeof(entry) <= summary.size(); pos += sizeof(entry)) {
+            std::memcpy(&entry, summary.data() + pos, sizeof(entry));
+            sealed[entry.segment] = entry.range;
+        }
+
+        const std::vector<std::string>* names = nullptr;
+        size_t found = 0;
+        for (uint64_t seg : listSegments(dir)) {
+            if (seg < start.segment) continue;
+            auto it = sealed.find(seg);
+            if (it != sealed.end() && (it->second.max < from || it->second.min > to)) continue;
+
+            uint64_t count = segmentRows(dir, seg);
+            uint64_t startRow = seg == start.segment ? start.row : 0;
+            auto index = readColumn<TimeRange>(segmentPath(dir, seg, "index"), 0, count / blockSize);
+            for (uint64_t b = startRow / blockSize; b * blockSize < count; ++b) {
+                // The last, incomplete block has no index entry and is always read
+                if (b < index.size() && (index[b].max < from || index[b].min > to)) continue;
+
+                uint64_t first = b * blockSize;
+                uint64_t size = std::min(blockSize, count - first);
+                auto times = readColumn<int64_t>(segmentPath(dir, seg, "time"), first, size);
+                auto begin = times.begin() + std::min<uint64_t>(times.size(), startRow > first ? startRow - first : 0);
+                auto match = std::find_if(begin, times.end(), [&](int64_t t) { return t >= from && t <= to; });
+                if (match == times.end()) continue;
+
+                auto players = readColumn<uint32_t>(segmentPath(dir, seg, "player"), first, size);
+                auto teams = readColumn<uint8_t>(segmentPath(dir, seg, "team"), first, size);
+                auto values = readColumn<int32_t>(segmentPath(dir, seg, "value"), first, size);
+                size = std::min({times.size(), players.size(), teams.size(), values.size()});
+                for (uint64_t i = match - times.begin(); i < size; ++i) {
+                    if (times[i] < from || times[i] > to) continue;
+                    if (!names || players[i] >= names->size()) names = &playerNames(dir);
+                    std::string player = players[i] < names->size() ? (*names)[players[i]] : std::string();
+                    out.push_back(Record{times[i], std::move(player), teams[i] != 0, values[i]});
+                    positions.push_back(Position{seg, first + i + 1});
+                    if (++found == limit) return;
+                }
+            }
+        }
+    }
+
+    // Reads a cursor from query: <directory>:<segment>:<row> per directory, comma separated
+    static std::map<std::string, Position> parseCursor(const std::string& cursor) {
+        std::map<std::string, Position> positions;
+        for (size_t start = 0; start < cursor.size();) {
+            size_t end = std::min(cursor.find(',', start), cursor.size());
+            std::string_view part(cursor.data() + start, end - start);
+            size_t second = part.rfind(':');
+            size_t first = second == std::string_view::npos || second == 0 ? std::string_view::npos : part.rfind(':', second - 1);
+            if (first == std::string_view::npos || first == 0) throw std::invalid_argument("malformed cursor");
+            Position& position = positions[std::string(part.substr(0, first))];
+            position.segment = std::stoull(std::string(part.substr(first + 1, second - first - 1)));
+            position.row = std::stoull(std::string(part.substr(second + 1)));
+            start = end + 1;
+        }
+        return positions;
+    }
+
+public:
+    // Queries read every directory under rootDirectory whose name starts with "worker-"
+    HistoryStore(const std::string& rootDirectory, const std::string& name) :
+        root(rootDirectory), directory(root / name) {
+        recover();
+        playersFile = openAppend((directory / "players").string());
+        openSegment();
+    }
+
+    ~HistoryStore() {
+        try {
+            flush();
+        } catch (const std::exception&) {
+        }
+        closeFile(playersFile);
+        closeSegment();
+    }
+
+    // Buffers one click; it is written out at the next flush
+    void append(int64_t time, std::string_view player, bool increment, int value) {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::string name(player);
+        for (char& c : name) {
+            if (c == '\n') c = ' ';
+        }
+        auto [it, added] = playerIds.emplace(name, static_cast<uint32_t>(playerIds.size()));
+        if (added) {
+            pendingNames += name;
+            pendingNames += '\n';
+        }
+        pendingTimes.push_back(time);
+        pendingPlayers.push_back(it->second);
+        pendingTeams.push_back(increment ? 1 : 0);
+        pendingValues.push_back(value);
+        if (pendingTimes.size() >= flushThreshold) {
+            flushLocked();
+        }
+    }
+
+    void flush() {
+        std::lock_guard<std::mutex> lock(mutex);
+        flushLocked();
+    }
+
+    // Clicks from every worker's directory with from <= time <= to, at most
+    // limit of them. Each directory's rows come in the order they were
+    // written, merged oldest first across directories. cursor is empty to
+    // start from the beginning or the cursor the previous page returned; on
+    // return it holds the cursor for the next page, or is empty when nothing
+    // is left. A cursor is a position in every directory, so pages neither
+    // repeat nor skip rows, even where a directory's times go backwards.
+    // Throws std::invalid_argument for a malformed cursor.
+    std::vector<Record> query(int64_t from, int64_t to, size_t limit, std::string& cursor) {
+        flush();
+        std::lock_guard<std::mutex> lock(readMutex);
+
+        // The next limit + 1 matches of each directory, one run per directory in matched
+        struct Run {
+            std::string name;
+            size_t next;
+            size_t end;
+        };
+        std::map<std::string, Position> positions = parseCursor(cursor);
+        std::vector<Run> runs;
+        std::vector<Record> matched;
+        std::vector<Position> after;
+        std::error_code ec;
+        for (const auto& entry : std::filesystem::directory_iterator(root, ec)) {
+            std::string name = entry.path().filename().string();
+            if (entry.is_directory() && name.rfind("worker-", 0) == 0) {
+                size_t first = matched.size();
+                scan(entry.path(), from, to, limit + 1, positions[name], matched, after);
+                if (matched.size() > first) runs.push_back(Run{name, first, matched.size()});
+            }
+        }
+
+        // Takes the oldest head of the runs each time, so a directory only
+        // ever continues after the last of its rows on this page
+        std::vector<Record> records;
+        while (records.size() < limit) {
+            Run* oldest = nullptr;
+            for (auto& run : runs) {
+                if (run.next < run.end && (!oldest || matched[run.next].time < matched[oldest->next].time)) oldest = &run;
+            }
+            if (!oldest) break;
+            records.push_back(std::move(matched[oldest->next]));
+            positions[oldest->name] = after[oldest->next];
+            ++oldest->next;
+        }
+
+        cursor.clear();
+        bool more = std::any_of(runs.begin(), runs.end(), [](const Run& run) { return run.next < run.end; });
+        if (more) {
+            for (const auto& [name, position] : positions) {
+                cursor += (cursor.empty() ? "" : ",") + name + ':' + std::to_string(position.segment) + ':' + std::to_string(position.row);
+            }
+        }
+        return records;
+    }
+
+};
@@ -0,0 +1,211 @@
+#pragma once
+
+#include "hyperloglog.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Count-Min sketch of clicks per player. Estimates never undercount and
+// overcount by at most e / width of all clicks with high probability.
+struct CountMinSketch {
+    static constexpr size_t depth = 4;
+    static constexpr size_t width = size_t(1) << 15;
+
+    std::atomic<uint32_t> counters[depth][width];
+
+    // Counts one click and returns the new estimate
+    uint32_t add(uint64_t hash) {
+        uint32_t estimate = UINT32_MAX;
+        for (size_t row = 0; row < depth; ++row) {
+            estimate = std::min(estimate, counters[row][index(hash, row)].fetch_add(1, std::memory_order_relaxed) + 1);
+        }
+        return estimate;
+    }
+
+    uint32_t estimate(uint64_t hash) const {
+        uint32_t estimate = UINT32_MAX;
+        for (size_t row = 0; row < depth; ++row) {
+            estimate = std::min(estimate, counters[row][index(hash, row)].load(std::memory_order_relaxed));
+        }
+        return estimate;
+    }
+
+private:
+    // Rows are derived from two halves of one hash instead of hashing the name again
+    static size_t index(uint64_t hash, size_t row) {
+        uint32_t h1 = static_cast<uint32_t>(hash);
+        uint32_t h2 = static_cast<uint32_t>(hash >> 32) | 1;
+        return (h1 + row * h2) % width;
+    }
+};
+
+// Space-Saving table of the players with the most clicks, split into
+// shards by hash. A player's slot holds its Count-Min estimate; a player
+// without a slot takes the smallest one in its shard once its estimate is
+// larger, so a flood of one-off names only churns the bottom of each shard.
+// Each slot's player fingerprint and count share one 64-bit word and
+// change by CAS, so updates are lock-free and a slot never pairs one
+// player's count with another's fingerprint. The words of a shard are
+// packed together so finding a player scans a few cache lines; names sit
+// apart, are rewritten under a ticketed sequence number like the GameState
+// event slots, so a worker dying mid-write never locks a slot, and are
+// checked against the fingerprint and a checksum of the text when read.
+struct HeavyHitters {
+    static constexpr size_t shards = 16;
+    static constexpr size_t slotsPerShard = 64;
+    static constexpr size_t nameCapacity = 64;
+
+    struct Name {
+        std::atomic<uint32_t> tickets; // Writes started
+        std::atomic<uint32_t> seq; // 2 * ticket + 1 while that write runs, 2 * ticket + 2 once it is done
+        std::atomic<uint32_t> fingerprint; // Fingerprint of the player in text
+        std::atomic<uint32_t> check; // Hash of text, catches text mixed by overlapping writes
+        char text[nameCapacity];
+    };
+
+    struct Shard {
+        std::atomic<uint64_t> entries[slotsPerShard]; // fingerprint << 32 | count, 0 while free
+        Name names[slotsPerShard];
+    };
+
+    struct Entry {
+        std::string name;
+        uint32_t clicks;
+    };
+
+    Shard shardsByHash[shards];
+
+    void offer(uint64_t hash, std::string_view name, uint32_t estimate) {
+        uint32_t fingerprint = fingerprintOf(hash);
+        Shard& shard = shardsByHash[hash >> 60];
+
+        size_t smallest = 0;
+        uint64_t smallestEntry = UINT64_MAX;
+        for (size_t i = 0; i < slotsPerShard; ++i) {
+            uint64_t entry = shard.entries[i].load(std::memory_order_relaxed);
+            if (fingerprintOf(entry) == fingerprint && entry != 0) {
+                while (countOf(entry) < estimate && fingerprintOf(entry) == fingerprint &&
+                       !shard.entries[i].compare_exchange_weak(entry, pack(fingerprint, estimate), std::memory_order_relaxed)) {
+                }
+                // Also redone when the last write never finished, e.g. its worker died
+                if (shard.names[i].fingerprint.load(std::memory_order_relaxed) != fingerprint ||
+                    (shard.names[i].seq.load(std::memory_order_relaxed) & 1)) {
+                    writeName(shard.names[i], fingerprint, name);
+                }
+                return;
+            }
+            if (smallestEntry == UINT64_MAX || countOf(entry) < countOf(smallestEntry)) {
+                smallest = i;
+                smallestEntry = entry;
+            }
+        }
+
+        if (estimate > countOf(smallestEntry) &&
+            shard.entries[smallest].compare_exchange_strong(smallestEntry, pack(fingerprint, estimate), std::memory_order_relaxed)) {
+            writeName(shard.names[smallest], fingerprint, name);
+        }
+    }
+
+    // Largest counts first; slots whose name is mid-rewrite are left out
+    std::vector<Entry> top(size_t count) const {
+        std::unordered_map<uint32_t, Entry> players;
+        for (const auto& shard : shardsByHash) {
+            for (size_t i = 0; i < slotsPerShard; ++i) {
+                uint64_t entry = shard.entries[i].load(std::memory_order_relaxed);
+                std::string name;
+                if (entry == 0 || !readName(shard.names[i], fingerprintOf(entry), name)) continue;
+                // Two workers adding a new player at once can give it two slots
+                Entry& player = players[fingerprintOf(entry)];
+                if (countOf(entry) >= player.clicks) {
+                    player = Entry{std::move(name), countOf(entry)};
+                }
+            }
+        }
+
+        std::vector<Entry> result;
+        for (auto& [fingerprint, player] : players) {
+            result.push_back(std::move(player));
+        }
+        size_t keep = std::min(count, result.size());
+        std::partial_sort(result.begin(), result.begin() + keep, result.end(), [](const Entry& a, const Entry& b) {
+            return a.clicks > b.clicks;
+        });
+        result.resize(keep);
+        return result;
+    }
+
+private:
+    static uint32_t fingerprintOf(uint64_t value) {
+        return static_cast<uint32_t>(value >> 32);
+    }
+
+    static uint32_t countOf(uint64_t entry) {
+        return static_cast<uint32_t>(entry);
+    }
+
+    static uint64_t pack(uint32_t fingerprint, uint32_t count) {
+        return (static_cast<uint64_t>(fingerprint) << 32) | count;
+    }
+
+    // Never waits: a write whose ticket is no longer the newest when it
+    // finishes leaves completing the slot to the newer one, and a write
+    // that never finishes is overtaken by the next
+    static void writeName(Name& slot, uint32_t fingerprint, std::string_view name) {
+        uint32_t ticket = slot.tickets.fetch_add(1, std::memory_order_relaxed);
+        slot.seq.store(2 * ticket + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        size_t length = std::min(name.size(), nameCapacity - 1);
+        while (length > 0 && length < name.size() && (static_cast<unsigned char>(name[length]) & 0xC0) == 0x80) {
+            --length;
+        }
+        std::memcpy(slot.text, name.data(), length);
+        slot.text[length] = '\0';
+        slot.check.store(checksum(std::string_view(slot.text, length)), std::memory_order_relaxed);
+        slot.fingerprint.store(fingerprint, std::memory_order_relaxed);
+        uint32_t writing = 2 * ticket + 1;
+        slot.seq.compare_exchange_strong(writing, 2 * ticket + 2, std::memory_order_release, std::memory_order_relaxed);
+    }
+
+    static uint32_t checksum(std::string_view text) {
+        return static_cast<uint32_t>(stableHash(text));
+    }
+
+    static bool readName(const Name& slot, uint32_t fingerprint, std::string& out) {
+        uint32_t before = slot.seq.load(std::memory_order_acquire);
+        if (before & 1) return false;
+        char name[nameCapacity];
+        std::memcpy(name, slot.text, nameCapacity);
+        uint32_t nameFingerprint = slot.fingerprint.load(std::memory_order_relaxed);
+        uint32_t check = slot.check.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.seq.load(std::memory_order_relaxed) != before || nameFingerprint != fingerprint) return false;
+        name[nameCapacity - 1] = '\0';
+        if (checksum(name) != check) return false;
+        out = name;
+        return true;
+    }
+};
+
+// Clicks per player in constant memory: point estimates from the sketch,
+// the top players from the Space-Saving table
+struct Leaderboard {
+    CountMinSketch sketch;
+    HeavyHitters heavyHitters;
+
+    void click(std::string_view player) {
+        uint64_t hash = stableHash(player);
+        heavyHitters.offer(hash, player, sketch.add(hash));
+    }
+
+    uint32_t estimate(std::string_view player) const {
+        return sketch.estimate(stableHash(player));
+    }
+};
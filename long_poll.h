@@ -0,0 +1,69 @@
+#pragma once
+
+#include "crow_all.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Requests to GET /api/wait parked until the state version moves past the
+// one their client has seen. Each worker keeps its own list. An update
+// renders the body once and answers every waiter it concerns in one pass;
+// each response is completed on its own connection's io_context, the
+// thread that would have written it had the handler answered at once.
+class LongPollWaiters {
+public:
+    using Clock = std::chrono::steady_clock;
+    using Render = std::function<std::string()>;
+
+    void park(const crow::request& req, crow::response& res, uint64_t since, Clock::duration timeout) {
+        std::lock_guard<std::mutex> lock(mutex);
+        waiters.push_back(Waiter{&res, req.io_context, since, Clock::now() + timeout});
+    }
+
+    // Answers the waiters that have seen less than version and those that
+    // timed out; with all set, every waiter
+    void notify(uint64_t version, const Render& render, bool all = false) {
+        std::vector<Waiter> ready;
+        auto now = Clock::now();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto done = std::partition(waiters.begin(), waiters.end(), [&](const Waiter& waiter) {
+                return !all && waiter.since >= version && waiter.deadline > now;
+            });
+            ready.assign(done, waiters.end());
+            waiters.erase(done, waiters.end());
+        }
+        if (ready.empty()) return;
+
+        auto body = std::make_shared<const std::string>(render());
+        for (const Waiter& waiter : ready) {
+            crow::asio::post(*waiter.io, [res = waiter.res, body]() {
+                res->set_header("Content-Type", "application/json");
+                res->body = *body;
+                res->end();
+            });
+        }
+    }
+
+    size_t size() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return waiters.size();
+    }
+
+private:
+    struct Waiter {
+        crow::response* res;
+        crow::asio::io_context* io;
+        uint64_t since;
+        Clock::time_point deadline;
+    };
+
+    std::mutex mutex;
+    std::vector<Waiter> waiters;
+};
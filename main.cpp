@@ -1,40 +1,132 @@
 #include "crow_all.h"
+#include "click_request.h"
+#include "wire_protocol.h"
+#include "shared_state.h"
+#include "cluster.h"
+#include "gossip.h"
+#include "event_log.h"
+#include "history_store.h"
+#include "site_config.h"
+#include "upgrade.h"
+#include "long_poll.h"
+#include "micro_cache.h"
+#include "state_snapshot.h"
 #include <atomic>
 #include <vector>
 #include <string>
+#include <string_view>
 #include <sstream>
 #include <iomanip>
 #include <ctime>
+#include <functional>
 #include <mutex>
+#include <unordered_set>
 
-struct Event {
-    std::string name;
-    std::string action;
-    int value;
-    std::string timestamp;
-};
+#include <pthread.h>
 
 class AtomicCounterServer {
 private:
-    std::atomic<int> counter;
-    std::vector<Event> recentEvents;
-    std::mutex eventsMutex;
+    // Counter and event ring, shared with the other workers in cluster mode
+    GameState& state;
+    uint32_t worker;
+    uint64_t nextForeignTicket = 0;
+
+    // Websocket subscribers, split by the format they negotiated
+    std::unordered_set<crow::websocket::connection*> textSubscribers;
+    std::unordered_set<crow::websocket::connection*> binarySubscribers;
+    WireEncoder wireEncoder;
+    std::mutex subscribersMutex;
+
+    std::function<void(const std::string&, bool, int)> logEvent;
+    HistoryStore* history = nullptr;
+
+    // Settings, page style and assets, swapped in whole when their files change
+    SiteConfigWatcher siteConfig;
+
+    // Long-polls parked on this worker; answered within 25 s, under common proxy idle timeouts
+    LongPollWaiters waiters;
+    static constexpr std::chrono::seconds waitTimeout{25};
+
+    // What pages render from, taken again after every change this worker
+    // sees. Builds are serialized; a click arriving during one asks for
+    // another and leaves it to the builder.
+    Published<StateSnapshot> snapshots;
+    std::atomic<uint64_t> snapshotRequests{0};
+    std::mutex snapshotMutex;
+
+    std::unique_ptr<const StateSnapshot> captureSnapshot() {
+        auto snapshot = StateSnapshot::capture(state, siteConfig.current()->settings.events);
+        snapshot->json = stateJson(*snapshot);
+        return snapshot;
+    }
+
+    // Applies one click, records it and pushes it to every subscriber. With
+    // a replicated event log the event is handed over instead, and reaches the
+    // ring and the subscribers once the leader has put it in order.
+    int recordClick(const std::string& name, bool increment) {
+        int new_value = state.click(increment);
+        std::time_t now = std::time(nullptr);
+        state.rollups.record(now, new_value);
+        state.uniquePlayers.add(now, name);
+        state.leaderboard.click(name);
+        if (logEvent) {
+            logEvent(name, increment, new_value);
+            return new_value;
+        }
+        state.appendEvent(name, increment, new_value, worker, now);
+        if (history) history->append(now, name, increment, new_value);
+        publish(name, increment, new_value);
+        stateChanged();
+        return new_value;
+    }
 
-    std::string getCurrentTimestamp() {
-        auto now = std::time(nullptr);
-        auto tm = *std::localtime(&now);
-        std::ostringstream oss;
-        oss << std::put_time(&tm, "%Y-%m-%d %H:%M:%S");
-        return oss.str();
+    // Everything the page shows that changes: a few hundred bytes
+    static std::string stateJson(const StateSnapshot& snapshot) {
+        crow::json::writer json(64 + snapshot.events.size() * (GameState::nameCapacity + 40));
+        json.begin_object()
+            .key("version").value(snapshot.version)
+            .key("value").value(snapshot.counter)
+            .key("events").begin_array();
+        for (const auto& record : snapshot.events) {
+            json.begin_object()
+                .key("name").value(record.name)
+                .key("action").value(record.increment ? "➕" : "➖")
+                .key("value").value(record.value)
+                .end_object();
+        }
+        json.end_array().end_object();
+        return std::move(json).str();
     }
 
-    void addEvent(const std::string& name, const std::string& action, int value) {
-        std::lock_guard<std::mutex> lock(eventsMutex);
-        Event event{name, action, value, getCurrentTimestamp()};
-        recentEvents.insert(recentEvents.begin(), event);
+    void publish(const std::string& name, bool increment, int value) {
+        std::lock_guard<std::mutex> lock(subscribersMutex);
+        if (!textSubscribers.empty()) {
+            crow::json::writer update;
+            update.begin_object()
+                .key("value").value(value)
+                .key("name").value(name)
+                .key("action").value(increment ? "➕" : "➖")
+                .end_object();
+            auto frame = crow::websocket::shared_frame::text(std::move(update).str());
+            for (auto* conn : textSubscribers) {
+                conn->send_latest(frame);
+            }
+        }
 
-        if (recentEvents.size() > 5) {
-            recentEvents.pop_back();
+        // Name frames must all arrive, updates only need the newest one to reach a slow client.
+        // A name first clicked while nobody listened gets its frame when it is next used.
+        if (binarySubscribers.empty()) return;
+        std::string nameFrame;
+        uint32_t id = wireEncoder.intern(name, nameFrame);
+        if (!nameFrame.empty()) {
+            auto frame = crow::websocket::shared_frame::binary(nameFrame);
+            for (auto* conn : binarySubscribers) {
+                conn->send_frame(frame);
+            }
+        }
+        auto frame = crow::websocket::shared_frame::binary(wireEncoder.update(id, increment, value));
+        for (auto* conn : binarySubscribers) {
+            conn->send_latest(frame);
         }
     }
 
@@ -54,12 +146,28 @@ private:
         return escaped.str();
     }
 
-    std::string urlDecode(const std::string& value) {
+    static std::string htmlEscape(std::string_view value) {
+        std::string result;
+        result.reserve(value.size());
+        for (char c : value) {
+            switch (c) {
+                case '<': result += "&lt;"; break;
+                case '>': result += "&gt;"; break;
+                case '&': result += "&amp;"; break;
+                case '\'': result += "&#39;"; break;
+                case '"': result += "&quot;"; break;
+                default: result += c;
+            }
+        }
+        return result;
+    }
+
+    std::string urlDecode(std::string_view value) {
         std::string result;
         for (size_t i = 0; i < value.size(); ++i) {
             if (value[i] == '%' && i + 2 < value.size()) {
                 int hexValue;
-                std::istringstream hexStream(value.substr(i + 1, 2));
+                std::istringstream hexStream(std::string(value.substr(i + 1, 2)));
                 if (hexStream >> std::hex >> hexValue) {
                     result += static_cast<char>(hexValue);
                     i += 2;
@@ -75,6 +183,32 @@ private:
         return result;
     }
 
+    // Reads name and team straight from the Cookie header without copying it
+    void parseCookies(const crow::request& req, std::string& name, std::string& team) {
+        std::string_view cookie_header = req.get_header_value("Cookie");
+        size_t pos = 0;
+        while (pos < cookie_header.size()) {
+            size_t eq_pos = cookie_header.find('=', pos);
+            if (eq_pos == std::string_view::npos) break;
+
+            size_t semi_pos = cookie_header.find(';', eq_pos);
+            if (semi_pos == std::string_view::npos) semi_pos = cookie_header.size();
+
+            std::string_view key = cookie_header.substr(pos, eq_pos - pos);
+            std::string_view value = cookie_header.substr(eq_pos + 1, semi_pos - eq_pos - 1);
+
+            // Trim whitespace
+            size_t key_begin = key.find_first_not_of(' ');
+            key = key_begin == std::string_view::npos ? std::string_view() : key.substr(key_begin);
+            key = key.substr(0, key.find_last_not_of(' ') + 1);
+
+            if (key == "name") name = urlDecode(value);
+            else if (key == "team") team = value;
+
+            pos = semi_pos + 1;
+        }
+    }
+
     std::string generateCSS() {
         return R"(
             <style>
@@ -207,69 +341,124 @@ private:
     }
 
 public:
-    AtomicCounterServer() : counter(0) {}
-
-    std::string handleGet(const crow::request& req) {
-        std::string name, team;
+    // How long browsers and caches in front may reuse /watch without asking again
+    static constexpr std::chrono::seconds watchMaxAge{1};
 
-        // Parse cookies
-        auto cookie_header = req.get_header_value("Cookie");
-        size_t pos = 0;
-        while (pos < cookie_header.size()) {
-            size_t eq_pos = cookie_header.find('=', pos);
-            if (eq_pos == std::string::npos) break;
+    AtomicCounterServer(GameState& state, uint32_t worker, const std::string& configPath) :
+        state(state), worker(worker), siteConfig(configPath, generateCSS(), renderShell), snapshots(captureSnapshot()) {
+        nextForeignTicket = state.eventHead.load();
+    }
 
-            size_t semi_pos = cookie_header.find(';', eq_pos);
-            if (semi_pos == std::string::npos) semi_pos = cookie_header.size();
+    // Routes clicks through the replicated event log
+    void setEventLog(std::function<void(const std::string&, bool, int)> handler) {
+        logEvent = std::move(handler);
+    }
 
-            std::string key = cookie_header.substr(pos, eq_pos - pos);
-            std::string value = cookie_header.substr(eq_pos + 1, semi_pos - eq_pos - 1);
+    // Full click history; with an event log the log's handler writes to it instead
+    void setHistory(HistoryStore* store) {
+        history = store;
+    }
 
-            // Trim whitespace
-            key.erase(0, key.find_first_not_of(" "));
-            key.erase(key.find_last_not_of(" ") + 1);
+    // Answers the long-polls whose version is behind, including after clicks
+    // on other workers or nodes; with all set, every parked poll, so a
+    // draining worker can stop
+    void notifyWaiters(bool all) {
+        auto snapshot = snapshots.read();
+        waiters.notify(snapshot->version, [&snapshot]() {
+            return snapshot->json;
+        }, all);
+    }
 
-            if (key == "name") name = urlDecode(value);
-            else if (key == "team") team = value;
+    // Publishes a snapshot taken after the caller's change
+    void publishSnapshot() {
+        snapshotRequests.fetch_add(1);
+        while (true) {
+            std::unique_lock<std::mutex> lock(snapshotMutex, std::try_to_lock);
+            if (!lock) return; // The builder sees the request before it stops
+            uint64_t served;
+            do {
+                served = snapshotRequests.load();
+                snapshots.publish(captureSnapshot());
+            } while (snapshotRequests.load() != served);
+            lock.unlock();
+            // A request made between the last check and the unlock found the mutex still held
+            if (snapshotRequests.load() == served) return;
+        }
+    }
 
-            pos = semi_pos + 1;
+    // Publishes a new snapshot if the state moved without this worker
+    // hearing about it: clicks on other workers or nodes, or a config reload
+    // that changed how many events are shown. An event that can't be read
+    // is simply missing until it scrolls out, it doesn't make the snapshot stale.
+    void refreshSnapshot() {
+        bool stale;
+        {
+            auto snapshot = snapshots.read();
+            stale = snapshot->version != state.version() || snapshot->eventCount != siteConfig.current()->settings.events;
         }
+        if (stale) publishSnapshot();
+    }
 
-        std::stringstream html;
-        html << "<!DOCTYPE html><html lang='ru'><head>"
-             << "<meta charset='UTF-8'>"
-             << "<meta name='viewport' content='width=device-width, initial-scale=1.0'>";
+    // After a click reaches the shared state through this worker
+    void stateChanged() {
+        publishSnapshot();
+        notifyWaiters(false);
+    }
 
-        // Добавляем автообновление только для страницы со счетчиком
-        if (!name.empty() && !team.empty()) {
-            html << "<meta http-equiv='refresh' content='2'>";
+    // GET /api/wait?since=<version>: answers at once when the client is
+    // behind, otherwise when the version moves past what it has seen or the
+    // wait times out, which gives the current version back. A client ahead of
+    // this worker, having seen a newer version elsewhere, waits like one that
+    // is up to date.
+    void handleWait(const crow::request& req, crow::response& res) {
+        const char* since = req.url_params.get("since");
+        char* end = nullptr;
+        uint64_t seen = since ? std::strtoull(since, &end, 10) : 0;
+        auto snapshot = snapshots.read();
+        if (!since || *since == '\0' || *end != '\0' || seen < snapshot->version) {
+            res.set_header("Content-Type", "application/json");
+            res.body = snapshot->json;
+            res.end();
+            return;
         }
+        waiters.park(req, res, seen, waitTimeout);
+    }
 
-        html << "<title>🫖 Счетчик</title>"
-             << generateCSS()
-             << "</head><body>"
-             << "<div class='container'>";
+    // Pushes clicks that other workers recorded to this worker's subscribers
+    void publishForeignEvents() {
+        uint64_t head = state.eventHead.load();
+        if (head - nextForeignTicket > GameState::eventCapacity) {
+            nextForeignTicket = head - GameState::eventCapacity;
+        }
+        GameState::EventRecord record;
+        for (; nextForeignTicket < head; ++nextForeignTicket) {
+            if (state.readEvent(nextForeignTicket, record) && record.worker != worker) {
+                publish(record.name, record.increment, record.value);
+            }
+        }
+    }
 
-        if (name.empty() || team.empty()) {
+    // The page as it was before the shell, for browsers without JavaScript
+    std::string renderServerPage(const crow::request& req) {
+        std::string name, team;
+        parseCookies(req, name, team);
+        // One version for the whole page, even if a reload lands halfway through
+        auto config = siteConfig.current();
+        const SiteConfig& site = *config;
+        auto snapshot = snapshots.read();
+
+        std::stringstream html;
+        // Добавляем автообновление только для страницы со счетчиком
+        bool playing = !name.empty() && !team.empty();
+        renderHead(html, site, playing ? site.settings.refresh : 0);
+
+        if (!playing) {
             // Show setup form
-            html << "<h1>Добро пожаловать!</h1>"
-                 << "<form class='setup-form' method='POST'>"
-                 << "<div class='form-group'>"
-                 << "<input type='text' name='name' placeholder='Ваше имя' required>"
-                 << "</div>"
-                 << "<div class='form-group'>"
-                 << "<select name='team' required>"
-                 << "<option value=''>Выберите команду</option>"
-                 << "<option value='plus'>➕ Плюс</option>"
-                 << "<option value='minus'>➖ Минус</option>"
-                 << "</select>"
-                 << "</div>"
-                 << "<input type='submit' value='Начать'>"
-                 << "</form>";
+            html << setupForm();
         } else {
             // Show counter interface
-            html << "<h1>Счетчик: " << name << "</h1>"
-                 << "<div class='counter'>" << counter.load() << "</div>";
+            html << "<h1>Счетчик: " << htmlEscape(name) << "</h1>"
+                 << "<div class='counter'>" << snapshot->counter << "</div>";
 
             // Форма для действия через POST
             html << "<form class='action-form' method='POST'>"
@@ -284,29 +473,196 @@ public:
             html << "</form>";
 
             // Show recent events
-            html << "<h2>Последние события</h2>"
-                 << "<table class='events-table'>"
-                 << "<tr><th>Имя</th><th>Действие</th><th>Значение</th></tr>"; // <th>Время</th> removed
-
-            std::lock_guard<std::mutex> lock(eventsMutex);
-            for (const auto& event : recentEvents) {
-                html << "<tr>"
-                     << "<td>" << event.name << "</td>"
-                     << "<td>" << event.action << "</td>"
-                     << "<td>" << event.value << "</td>"
-                     // << "<td>" << event.timestamp << "</td>"
-                     << "</tr>";
-            }
-
-            html << "</table>";
+            renderEvents(html, *snapshot);
         }
 
         html << "</div></body></html>";
         return html.str();
     }
 
+    // Everything before a page's content; refresh above 0 reloads the page
+    // that often, extraHead goes in <head> as it is
+    static void renderHead(std::ostream& html, const SiteConfig& site, int refresh, std::string_view extraHead = {}) {
+        html << "<!DOCTYPE html><html lang='ru'><head>"
+             << "<meta charset='UTF-8'>"
+             << "<meta name='viewport' content='width=device-width, initial-scale=1.0'>";
+        if (refresh > 0) {
+            html << "<meta http-equiv='refresh' content='" << refresh << "'>";
+        }
+        html << extraHead
+             << "<title>🫖 Счетчик</title>"
+             << site.style
+             << "</head><body>"
+             << "<div class='container'>";
+    }
+
+    // The recent events table; player names are escaped here, for every page
+    static void renderEvents(std::ostream& html, const StateSnapshot& snapshot) {
+        html << "<h2>Последние события</h2>"
+             << "<table class='events-table'>"
+             << "<tr><th>Имя</th><th>Действие</th><th>Значение</th></tr>";
+        for (const auto& event : snapshot.events) {
+            html << "<tr>"
+                 << "<td>" << htmlEscape(event.name) << "</td>"
+                 << "<td>" << (event.increment ? "➕" : "➖") << "</td>"
+                 << "<td>" << event.value << "</td>"
+                 << "</tr>";
+        }
+        html << "</table>";
+    }
+
+    static const char* setupForm() {
+        return "<h1>Добро пожаловать!</h1>"
+               "<form class='setup-form' method='POST' action='/'>"
+               "<div class='form-group'>"
+               "<input type='text' name='name' placeholder='Ваше имя' required>"
+               "</div>"
+               "<div class='form-group'>"
+               "<select name='team' required>"
+               "<option value=''>Выберите команду</option>"
+               "<option value='plus'>➕ Плюс</option>"
+               "<option value='minus'>➖ Минус</option>"
+               "</select>"
+               "</div>"
+               "<input type='submit' value='Начать'>"
+               "</form>";
+    }
+
+    // Reads the player from the cookies, then keeps the counter and the
+    // events table current from /api/state and /api/wait, and clicks
+    // through /api/click, all without reloading the page
+    static const char* pageScript() {
+        return R"(
+            (function() {
+                var cookies = {};
+                document.cookie.split(';').forEach(function(cookie) {
+                    var eq = cookie.indexOf('=');
+                    if (eq > 0) cookies[cookie.slice(0, eq).trim()] = decodeURIComponent(cookie.slice(eq + 1));
+                });
+                if (!cookies.name || !cookies.team) {
+                    document.getElementById('setup').hidden = false;
+                    return;
+                }
+
+                var delta = cookies.team == 'plus' ? 1 : -1;
+                var counter = document.getElementById('counter');
+                var events = document.getElementById('events');
+                var button = document.getElementById('click');
+                document.getElementById('player').textContent = 'Счетчик: ' + cookies.name;
+                button.textContent = delta > 0 ? '➕ Увеличить' : '➖ Уменьшить';
+                document.getElementById('game').hidden = false;
+
+                var version = -1, nonce = 0;
+                function show(state) {
+                    version = state.version;
+                    counter.textContent = state.value;
+                    while (events.rows.length > 1) events.deleteRow(1);
+                    state.events.forEach(function(event) {
+                        var row = events.insertRow();
+                        [event.name, event.action, event.value].forEach(function(text) {
+                            row.insertCell().textContent = text;
+                        });
+                    });
+                }
+
+                function poll() {
+                    fetch(version < 0 ? '/api/state' : '/api/wait?since=' + version)
+                        .then(function(r) { return r.json(); })
+                        .then(function(state) { show(state); if (refresh > 0) poll(); })
+                        .catch(function() { setTimeout(poll, (refresh || 2) * 1000); });
+                }
+                poll();
+
+                button.addEventListener('click', function() {
+                    fetch('/api/click', {method: 'POST', body: JSON.stringify({player: cookies.name, delta: delta, nonce: ++nonce})})
+                        .then(function(r) { return r.json(); })
+                        .then(function(result) { counter.textContent = result.value; });
+                });
+            })();
+        )";
+    }
+
+    // Same for every visitor and every state, so browsers keep it and only
+    // revalidate; everything that changes comes from /api/state
+    static std::string renderShell(const SiteConfig& site) {
+        std::stringstream html;
+        renderHead(html, site, 0, "<noscript><meta http-equiv='refresh' content='0; url=/?noscript=1'></noscript>");
+        html << "<div id='setup' hidden>" << setupForm() << "</div>"
+             << "<div id='game' hidden>"
+             << "<h1 id='player'></h1>"
+             << "<div class='counter' id='counter'></div>"
+             << "<button type='button' class='button' id='click'></button>"
+             << "<h2>Последние события</h2>"
+             << "<table class='events-table' id='events'>"
+             << "<tr><th>Имя</th><th>Действие</th><th>Значение</th></tr>"
+             << "</table>"
+             << "</div>"
+             << "</div>"
+             << "<script>var refresh = " << site.settings.refresh << ";" << pageScript() << "</script>"
+             << "</body></html>";
+        return html.str();
+    }
+
+    // GET /: the shell, answered with 304 while it hasn't changed
+    crow::response handleGet(const crow::request& req) {
+        if (req.url_params.get("noscript")) {
+            return crow::response(renderServerPage(req));
+        }
+        auto config = siteConfig.current();
+        const SiteConfig& site = *config;
+        crow::response response;
+        response.set_header("ETag", site.pageEtag);
+        response.set_header("Cache-Control", "no-cache");
+        if (req.get_header_value("If-None-Match") == site.pageEtag) {
+            response.code = 304;
+            return response;
+        }
+        response.set_header("Content-Type", "text/html; charset=utf-8");
+        response.body = site.page;
+        return response;
+    }
+
+    // GET /watch: the counter and the events for spectators, without a
+    // player's name or button, so the page is the same for everyone and any
+    // cache in front can share it. The ETag follows the state version and
+    // the config, which lets a revalidation be answered before rendering.
+    crow::response handleWatch(const crow::request& req) {
+        auto config = siteConfig.current();
+        const SiteConfig& site = *config;
+        auto snapshot = snapshots.read();
+        std::string etag = "\"" + std::to_string(snapshot->version) + "-" +
+                           std::to_string(std::hash<std::string>()(site.pageEtag + std::to_string(site.settings.events))) + "\"";
+
+        crow::response response;
+        response.set_header("ETag", etag);
+        response.set_header("Cache-Control", "public, max-age=" + std::to_string(watchMaxAge.count()) + ", stale-while-revalidate=30");
+        if (req.get_header_value("If-None-Match") == etag) {
+            response.code = 304;
+            return response;
+        }
+
+        std::stringstream html;
+        renderHead(html, site, site.settings.refresh);
+        html << "<h1>Счетчик</h1>"
+             << "<div class='counter'>" << snapshot->counter << "</div>";
+        renderEvents(html, *snapshot);
+        html << "</div></body></html>";
+
+        response.set_header("Content-Type", "text/html; charset=utf-8");
+        response.body = html.str();
+        return response;
+    }
+
+    // GET /api/state
+    crow::response handleState() {
+        crow::response response(snapshots.read()->json);
+        response.set_header("Content-Type", "application/json");
+        response.set_header("Cache-Control", "no-store");
+        return response;
+    }
+
     crow::response handlePost(const crow::request& req) {
-        std::string body = req.body;
+        std::string_view body = req.body;
         std::string name, team;
         bool performAction = false;
 
@@ -315,20 +671,19 @@ public:
         size_t team_pos = body.find("team=");
         size_t action_pos = body.find("perform_action=");
 
-        if (name_pos != std::string::npos) {
+        if (name_pos != std::string_view::npos) {
             size_t name_end = body.find('&', name_pos);
-            if (name_end == std::string::npos) name_end = body.size();
-            name = body.substr(name_pos + 5, name_end - name_pos - 5);
-            name = urlDecode(name);
+            if (name_end == std::string_view::npos) name_end = body.size();
+            name = urlDecode(body.substr(name_pos + 5, name_end - name_pos - 5));
         }
 
-        if (team_pos != std::string::npos) {
+        if (team_pos != std::string_view::npos) {
             size_t team_end = body.find('&', team_pos);
-            if (team_end == std::string::npos) team_end = body.size();
+            if (team_end == std::string_view::npos) team_end = body.size();
             team = body.substr(team_pos + 5, team_end - team_pos - 5);
         }
 
-        if (action_pos != std::string::npos) {
+        if (action_pos != std::string_view::npos) {
             performAction = true;
         }
 
@@ -336,37 +691,14 @@ public:
 
         if (performAction) {
             // Действие от пользователя - получаем куки и выполняем действие
-            auto cookie_header = req.get_header_value("Cookie");
             std::string cookie_name, cookie_team;
-
-            size_t pos = 0;
-            while (pos < cookie_header.size()) {
-                size_t eq_pos = cookie_header.find('=', pos);
-                if (eq_pos == std::string::npos) break;
-
-                size_t semi_pos = cookie_header.find(';', eq_pos);
-                if (semi_pos == std::string::npos) semi_pos = cookie_header.size();
-
-                std::string key = cookie_header.substr(pos, eq_pos - pos);
-                std::string value = cookie_header.substr(eq_pos + 1, semi_pos - eq_pos - 1);
-
-                key.erase(0, key.find_first_not_of(" "));
-                key.erase(key.find_last_not_of(" ") + 1);
-
-                if (key == "name") cookie_name = urlDecode(value);
-                else if (key == "team") cookie_team = value;
-
-                pos = semi_pos + 1;
-            }
+            parseCookies(req, cookie_name, cookie_team);
 
             if (!cookie_name.empty() && !cookie_team.empty()) {
-                int new_value;
                 if (cookie_team == "plus") {
-                    new_value = ++counter;
-                    addEvent(cookie_name, "➕", new_value);
+                    recordClick(cookie_name, true);
                 } else if (cookie_team == "minus") {
-                    new_value = --counter;
-                    addEvent(cookie_name, "➖", new_value);
+                    recordClick(cookie_name, false);
                 }
             }
 
@@ -389,11 +721,344 @@ public:
 
         return response;
     }
+
+    crow::response handleClick(const crow::request& req) {
+        ClickRequest click;
+        if (!ClickRequestReader(req.body).read(click) || click.player.empty() || (click.delta != 1 && click.delta != -1)) {
+            return crow::response(400, "Invalid click");
+        }
+
+        int new_value = recordClick(std::string(click.player), click.delta > 0);
+
+        crow::json::writer result(48);
+        result.begin_object()
+            .key("value").value(new_value)
+            .key("nonce").value(click.nonce)
+            .end_object();
+        crow::response response(std::move(result).str());
+        response.set_header("Content-Type", "application/json");
+        return response;
+    }
+
+    crow::response handleAsset(const crow::request& req, const std::string& path) {
+        auto config = siteConfig.current();
+        const SiteConfig& site = *config;
+        auto it = site.assets.find(path);
+        if (it == site.assets.end()) return crow::response(404);
+        const Asset& asset = it->second;
+
+        crow::response response;
+        response.set_header("ETag", asset.etag);
+        response.set_header("Content-Type", asset.contentType);
+        if (req.get_header_value("If-None-Match") == asset.etag) {
+            response.code = 304;
+            return response;
+        }
+#ifdef CROW_ENABLE_COMPRESSION
+        if (req.get_header_value("Accept-Encoding").find("gzip") != std::string::npos) {
+            response.set_header("Content-Encoding", "gzip");
+            response.body = asset.gzipped;
+            return response;
+        }
+#endif
+        response.body = asset.content;
+        return response;
+    }
+
+    crow::response handleHistory(const crow::request& req) {
+        if (!history) return crow::response(404);
+
+        int64_t from = 0, to = std::time(nullptr);
+        size_t limit = 1000;
+        std::string cursor = req.url_params.get("cursor") ? req.url_params.get("cursor") : "";
+        std::vector<HistoryStore::Record> records;
+        try {
+            if (const char* value = req.url_params.get("from")) from = std::stoll(value);
+            if (const char* value = req.url_params.get("to")) to = std::stoll(value);
+            if (const char* value = req.url_params.get("limit")) limit = std::clamp<size_t>(std::stoul(value), 1, 10000);
+            records = history->query(from, to, limit, cursor);
+        } catch (const std::logic_error&) {
+            return crow::response(400, "from and to must be unix times and cursor one returned before");
+        }
+
+        std::vector<crow::json::wvalue> events;
+        for (const auto& record : records) {
+            crow::json::wvalue event;
+            event["time"] = record.time;
+            event["name"] = record.player;
+            event["team"] = record.increment ? "plus" : "minus";
+            event["value"] = record.value;
+            events.push_back(std::move(event));
+        }
+
+        crow::json::wvalue result;
+        result["events"] = std::move(events);
+        // Ask again with the same range and this cursor to get the rest
+        result["truncated"] = !cursor.empty();
+        if (!cursor.empty()) result["cursor"] = cursor;
+        return crow::response(result);
+    }
+
+    // Counter over time at one resolution, oldest bucket first, as one array per field
+    template<typename Series>
+    crow::json::wvalue series(const Series& rollup, size_t points) {
+        points = std::min(points, Series::buckets);
+        int64_t now = std::time(nullptr);
+        int64_t start = (now / Series::seconds - static_cast<int64_t>(points) + 1) * Series::seconds;
+
+        std::vector<crow::json::wvalue> min, max, last, count;
+        for (size_t i = 0; i < points; ++i) {
+            auto point = rollup.read(start + static_cast<int64_t>(i) * Series::seconds);
+            count.emplace_back(point.count);
+            // Empty buckets are null so charts can show the gap
+            min.emplace_back(point.count ? crow::json::wvalue(point.min) : crow::json::wvalue());
+            max.emplace_back(point.count ? crow::json::wvalue(point.max) : crow::json::wvalue());
+            last.emplace_back(point.count ? crow::json::wvalue(point.last) : crow::json::wvalue());
+        }
+
+        crow::json::wvalue result;
+        result["start"] = start;
+        result["step"] = Series::seconds;
+        result["min"] = std::move(min);
+        result["max"] = std::move(max);
+        result["last"] = std::move(last);
+        result["count"] = std::move(count);
+        return result;
+    }
+
+    crow::response handleSeries(const crow::request& req) {
+        std::string resolution = req.url_params.get("resolution") ? req.url_params.get("resolution") : "second";
+        size_t points = 0;
+        if (const char* value = req.url_params.get("points")) {
+            points = std::strtoul(value, nullptr, 10);
+        }
+
+        if (resolution == "second") return crow::response(series(state.rollups.seconds, points ? points : 300));
+        if (resolution == "minute") return crow::response(series(state.rollups.minutes, points ? points : 60));
+        if (resolution == "hour") return crow::response(series(state.rollups.hours, points ? points : 24));
+        return crow::response(400, "resolution must be second, minute or hour");
+    }
+
+    // Distinct players this hour and since midnight UTC. With format=sketch the
+    // merged registers of one window are returned instead, for merging with
+    // the sketches of other nodes.
+    crow::response handleUniques(const crow::request& req) {
+        uint32_t hour = static_cast<uint32_t>(std::time(nullptr) / 3600);
+        uint32_t midnight = hour - hour % 24;
+        auto thisHour = state.uniquePlayers.merged(hour, hour);
+        auto today = state.uniquePlayers.merged(midnight, hour);
+
+        const char* format = req.url_params.get("format");
+        if (format && std::string_view(format) == "sketch") {
+            const char* window = req.url_params.get("window");
+            const auto& sketch = window && std::string_view(window) == "today" ? today : thisHour;
+            crow::response response(std::string(sketch.begin(), sketch.end()));
+            response.set_header("Content-Type", "application/octet-stream");
+            return response;
+        }
+
+        crow::json::wvalue result;
+        result["hour"] = std::llround(UniquePlayers::Sketch::estimate(thisHour));
+        result["today"] = std::llround(UniquePlayers::Sketch::estimate(today));
+        return crow::response(result);
+    }
+
+    // Top 100 players by clicks, or ?player=name for one player's estimate
+    crow::json::wvalue handleLeaderboard(const crow::request& req) {
+        crow::json::wvalue result;
+        if (const char* player = req.url_params.get("player")) {
+            result["name"] = player;
+            result["clicks"] = state.leaderboard.estimate(player);
+            return result;
+        }
+
+        std::vector<crow::json::wvalue> players;
+        for (auto& entry : state.leaderboard.heavyHitters.top(100)) {
+            crow::json::wvalue player;
+            player["name"] = std::move(entry.name);
+            player["clicks"] = entry.clicks;
+            players.push_back(std::move(player));
+        }
+        result["players"] = std::move(players);
+        return result;
+    }
+
+    crow::json::wvalue stats(crow::websocket::stats& websocketStats) {
+        crow::json::wvalue result;
+        {
+            std::lock_guard<std::mutex> lock(subscribersMutex);
+            result["subscribers"] = textSubscribers.size() + binarySubscribers.size();
+        }
+        result["conflated"] = websocketStats.conflated.load();
+        result["dropped"] = websocketStats.dropped.load();
+        return result;
+    }
+
+    void subscribe(crow::websocket::connection& conn) {
+        std::lock_guard<std::mutex> lock(subscribersMutex);
+        if (conn.get_subprotocol() == WireEncoder::subprotocol) {
+            binarySubscribers.insert(&conn);
+            conn.send_binary(wireEncoder.snapshot(state.counter()));
+        } else {
+            textSubscribers.insert(&conn);
+            crow::json::wvalue snapshot;
+            snapshot["value"] = state.counter();
+            conn.send_text(snapshot.dump());
+        }
+    }
+
+    void unsubscribe(crow::websocket::connection& conn) {
+        std::lock_guard<std::mutex> lock(subscribersMutex);
+        textSubscribers.erase(&conn);
+        if (binarySubscribers.erase(&conn) && binarySubscribers.empty()) {
+            wireEncoder.clear();
+        }
+    }
+};
+
+struct Options {
+    uint16_t port = 8080;
+    int workers = 1;
+    uint64_t nodeId = 0;      // Non-zero enables replication with other nodes
+    uint16_t gossipPort = 0;
+    std::string gossipBind = "0.0.0.0"; // Interface the gossip port listens on
+    std::string gossipSecret;           // Shared by all nodes; empty accepts tallies from anyone
+    std::vector<std::string> peers; // host:port of other nodes' gossip ports
+    uint16_t logPort = 0;      // Non-zero makes this node the event log leader
+    std::string logBind = "0.0.0.0"; // Interface the log port listens on
+    std::string logSecret;           // Shared by the leader and its clients; empty takes clicks from anyone
+    std::string logLeader;     // host:port of the leader's log port, for the other nodes
+    std::string historyDir;    // Defaults to history-<port>
+    std::string configPath;    // Settings that are reloaded while running
+    std::string upgradeSocket; // Unix socket a new instance can take over through
+    std::string takeOver;      // Upgrade socket of the instance to replace
+    int drainSeconds = 10;     // How long a stopping worker lets open connections finish
+    int microCacheMs = 100;    // How long public views are shared between requests, 0 for never
+
+    // Set in main when the listening socket is opened up front so it can be handed on
+    int listenFd = -1;
+    uint32_t generation = 0;
 };
 
-int main() {
-    crow::SimpleApp app;
-    AtomicCounterServer server;
+Options parseOptions(int argc, char** argv) {
+    Options options;
+    bool portGiven = false;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string name = argv[i];
+        std::string value = argv[i + 1];
+        if (name == "--port") options.port = static_cast<uint16_t>(std::stoi(value)), portGiven = true;
+        else if (name == "--workers") options.workers = std::max(1, std::stoi(value));
+        else if (name == "--node-id") options.nodeId = std::stoull(value);
+        else if (name == "--gossip-port") options.gossipPort = static_cast<uint16_t>(std::stoi(value));
+        else if (name == "--gossip-bind") options.gossipBind = value;
+        else if (name == "--gossip-secret") options.gossipSecret = value;
+        else if (name == "--peer") options.peers.push_back(value);
+        else if (name == "--log-port") options.logPort = static_cast<uint16_t>(std::stoi(value));
+        else if (name == "--log-bind") options.logBind = value;
+        else if (name == "--log-secret") options.logSecret = value;
+        else if (name == "--log-leader") options.logLeader = value;
+        else if (name == "--history-dir") options.historyDir = value;
+        else if (name == "--config") options.configPath = value;
+        else if (name == "--upgrade-socket") options.upgradeSocket = value;
+        else if (name == "--take-over") options.takeOver = value;
+        else if (name == "--drain") options.drainSeconds = std::clamp(std::stoi(value), 0, 255);
+        else if (name == "--micro-cache-ms") options.microCacheMs = std::max(0, std::stoi(value));
+        else throw std::invalid_argument("unknown option " + name);
+    }
+    // The command line wins over the config file
+    if (!portGiven && !options.configPath.empty()) {
+        options.port = Settings::load(options.configPath).port;
+    }
+    if (options.historyDir.empty()) {
+        options.historyDir = "history-" + std::to_string(options.port);
+    }
+    return options;
+}
+
+crow::tcp::endpoint resolveEndpoint(const std::string& address) {
+    size_t colon = address.rfind(':');
+    if (colon == std::string::npos) throw std::invalid_argument("address must be host:port, got " + address);
+    crow::asio::io_context io;
+    crow::tcp::resolver resolver(io);
+    auto results = resolver.resolve(crow::tcp::v4(), address.substr(0, colon), address.substr(colon + 1));
+    return results.begin()->endpoint();
+}
+
+std::unique_ptr<GossipNode> startGossip(GameState& state, const Options& options) {
+    std::vector<crow::tcp::endpoint> peers;
+    for (const auto& peer : options.peers) {
+        peers.push_back(resolveEndpoint(peer));
+    }
+
+    if (options.gossipSecret.empty()) {
+        CROW_LOG_WARNING << "No --gossip-secret given, any client reaching " << options.gossipBind << ':' << options.gossipPort
+                         << " can change the counter";
+    }
+    crow::tcp::endpoint endpoint(crow::asio::ip::make_address(options.gossipBind), options.gossipPort);
+    auto gossip = std::make_unique<GossipNode>(state, options.nodeId, endpoint, peers, options.gossipSecret);
+    gossip->start();
+    return gossip;
+}
+
+// Runs one server process; in cluster mode several of these share the port and the game state.
+// onServing runs once the server accepts connections.
+int runWorker(GameState& state, uint32_t worker, const Options& options, std::function<void()> onServing = nullptr) {
+    bool clustered = options.workers > 1;
+    crow::App<MicroCache> app;
+    AtomicCounterServer server(state, worker, options.configPath);
+    // The instance taking over during an upgrade writes next to this one's directory, never into it
+    HistoryStore history(options.historyDir, "worker-" + std::to_string(worker) + (options.generation % 2 ? "-b" : ""));
+    server.setHistory(&history);
+
+    // One process per node exchanges tallies with the other nodes
+    std::unique_ptr<GossipNode> gossip;
+    if (options.nodeId != 0 && worker == 0) {
+        gossip = startGossip(state, options);
+    }
+
+    // Worker 0 of the leader node keeps the event log; every other worker
+    // submits to it, and worker 0 of each other node also follows it
+    std::unique_ptr<EventLogLeader> logLeader;
+    std::unique_ptr<EventLogClient> logClient;
+    auto logAddress = crow::asio::ip::make_address(options.logBind);
+    if (options.logPort != 0 && worker == 0) {
+        if (options.logSecret.empty()) {
+            CROW_LOG_WARNING << "No --log-secret given, any client reaching " << options.logBind << ':' << options.logPort
+                             << " can add clicks and read the event log";
+        }
+        logLeader = std::make_unique<EventLogLeader>(state, crow::tcp::endpoint(logAddress, options.logPort), options.logSecret);
+        logLeader->setEventHandler([&history, &server](std::string_view name, bool increment, int value, int64_t time) {
+            history.append(time, name, increment, value);
+            server.stateChanged();
+        });
+        logLeader->start();
+        server.setEventLog([&logLeader](const std::string& name, bool increment, int value) {
+            logLeader->append(name, increment, value);
+        });
+    } else if (options.logPort != 0 || !options.logLeader.empty()) {
+        // The leader node's other workers reach worker 0 on the interface it listens on
+        auto local = logAddress.is_unspecified() ? crow::asio::ip::address(crow::asio::ip::address_v4::loopback()) : logAddress;
+        auto leader = options.logPort != 0 ? crow::tcp::endpoint(local, options.logPort) : resolveEndpoint(options.logLeader);
+        logClient = std::make_unique<EventLogClient>(state, leader, options.logSecret, options.logPort == 0 && worker == 0);
+        logClient->setEventHandler([&history, &server](std::string_view name, bool increment, int value, int64_t time) {
+            history.append(time, name, increment, value);
+            server.stateChanged();
+        });
+        logClient->start();
+        server.setEventLog([&logClient](const std::string& name, bool increment, int value) {
+            logClient->submit(name, increment, value);
+        });
+    }
+
+    // Views that are the same for everyone; a crowd asking at once costs one handler call per TTL
+    std::chrono::milliseconds microCacheTtl(options.microCacheMs);
+    app.get_middleware<MicroCache>()
+      .cache("/api/state", microCacheTtl)
+      .cache("/leaderboard", microCacheTtl, {"player"})
+      .cache("/api/uniques", microCacheTtl, {"format", "window"})
+      .cache("/api/series", microCacheTtl, {"resolution", "points"})
+      .cache("/history", microCacheTtl, {"from", "to", "limit", "cursor"})
+      .cache("/watch", microCacheTtl.count() > 0 ? std::chrono::milliseconds(AtomicCounterServer::watchMaxAge) : microCacheTtl);
 
     CROW_ROUTE(app, "/")
         .methods("GET"_method)
@@ -407,8 +1072,181 @@ int main() {
             return server.handlePost(req);
         });
 
-    std::cout << "Server running on :8080" << std::endl;
-    app.port(8080).multithreaded().run();
+    CROW_ROUTE(app, "/api/click")
+        .methods("POST"_method)
+        ([&server](const crow::request& req) {
+            return server.handleClick(req);
+        });
+
+    CROW_ROUTE(app, "/watch")
+        .methods("GET"_method)
+        ([&server](const crow::request& req) {
+            return server.handleWatch(req);
+        });
+
+    CROW_ROUTE(app, "/api/state")
+        .methods("GET"_method)
+        ([&server]() {
+            return server.handleState();
+        });
+
+    CROW_ROUTE(app, "/api/wait")
+        .methods("GET"_method)
+        ([&server](const crow::request& req, crow::response& res) {
+            server.handleWait(req, res);
+        });
+
+    CROW_WEBSOCKET_ROUTE(app, "/ws")
+        .subprotocols({WireEncoder::subprotocol})
+        .onopen([&server](crow::websocket::connection& conn) {
+            server.subscribe(conn);
+        })
+        .onclose([&server](crow::websocket::connection& conn, const std::string&, uint16_t) {
+            server.unsubscribe(conn);
+        })
+        .onerror([&server](crow::websocket::connection& conn, const std::string&) {
+            server.unsubscribe(conn);
+        });
+
+    CROW_ROUTE(app, "/assets/<path>")
+        .methods("GET"_method)
+        ([&server](const crow::request& req, const std::string& path) {
+            return server.handleAsset(req, path);
+        });
+
+    CROW_ROUTE(app, "/history")
+        .methods("GET"_method)
+        ([&server](const crow::request& req) {
+            return server.handleHistory(req);
+        });
+
+    CROW_ROUTE(app, "/api/series")
+        .methods("GET"_method)
+        ([&server](const crow::request& req) {
+            return server.handleSeries(req);
+        });
+
+    CROW_ROUTE(app, "/api/uniques")
+        .methods("GET"_method)
+        ([&server](const crow::request& req) {
+            return server.handleUniques(req);
+        });
+
+    CROW_ROUTE(app, "/leaderboard")
+        .methods("GET"_method)
+        ([&server](const crow::request& req) {
+            return server.handleLeaderboard(req);
+        });
+
+    CROW_ROUTE(app, "/api/stats")
+        .methods("GET"_method)
+        ([&server, &app, &state, &logLeader, &logClient]() {
+            auto result = server.stats(app.websocket_stats());
+            if (logLeader || logClient) {
+                result["eventLogSeq"] = state.replicatedSeq.load();
+            }
+            if (logLeader) result["eventsShipped"] = logLeader->shipped.load();
+            if (logClient) result["eventsApplied"] = logClient->applied.load();
+            return result;
+        });
+
+    // Clicks handled by other workers or ordered by the event log only show up in the shared ring.
+    // Buffered history is written out on the same tick, so queries lag by at most that much.
+    // Long-polls see other workers' and nodes' clicks on the tick too, and are all answered once draining.
+    bool relayEvents = clustered || logLeader || logClient;
+    if (options.listenFd >= 0) {
+        app.listen_fd(options.listenFd);
+    } else {
+        app.reuse_port(clustered);
+    }
+    app.tick(std::chrono::milliseconds(50), [&server, &history, &app, relayEvents]() {
+        if (relayEvents) server.publishForeignEvents();
+        server.refreshSnapshot();
+        server.notifyWaiters(app.draining());
+        history.flush();
+    });
+
+    std::thread serving;
+    if (onServing) {
+        serving = std::thread([&app, onServing]() {
+            if (app.wait_for_server_start() == std::cv_status::no_timeout) onServing();
+        });
+    }
+
+    std::cout << "Server running on :" << options.port << " (worker " << worker << ")" << std::endl;
+    // The forms only ever post a name and a team, anything bigger is rejected before it is read
+    // A subscriber that falls this far behind is disconnected, clients reconnect and get a fresh snapshot
+    app.port(options.port).drain_timeout(static_cast<uint8_t>(options.drainSeconds)).max_body_size(4096).websocket_max_queue(256).multithreaded().run();
+    if (serving.joinable()) serving.join();
 
     return 0;
 }
+
+// Opens the listening socket and game state up front, serves them to a
+// successor on the upgrade socket, and when one takes them stops like on SIGTERM
+int runUpgradable(Options& options) {
+    Handoff handoff;
+    if (!options.takeOver.empty()) {
+        handoff = takeOver(options.takeOver);
+    }
+    options.listenFd = handoff.listenFd >= 0 ? handoff.listenFd : openListener(options.port);
+    options.generation = handoff.generation;
+
+    int stateFd = handoff.stateFd;
+    if (stateFd >= 0 && !GameState::compatible(stateFd)) {
+        std::cout << "Game state layout changed, carrying over the counter only" << std::endl;
+        close(stateFd);
+        stateFd = -1;
+    }
+    bool fresh = stateFd < 0;
+    if (fresh) {
+        stateFd = GameState::create();
+    }
+    GameState* state = GameState::attach(stateFd);
+    if (fresh) {
+        state->restore(handoff.snapshot);
+    }
+
+    pthread_t mainThread = pthread_self();
+    UpgradeListener upgrades(
+      options.upgradeSocket.empty() ? options.takeOver : options.upgradeSocket, options.listenFd, stateFd, handoff.generation,
+      [state]() {
+          return state->snapshot();
+      },
+      [mainThread]() {
+          std::cout << "Handed over to the new instance, stopping" << std::endl;
+          pthread_kill(mainThread, SIGTERM);
+      });
+    upgrades.start();
+
+    auto ready = [&handoff]() {
+        confirmReady(handoff);
+    };
+    if (options.workers == 1) {
+        return runWorker(*state, 0, options, ready);
+    }
+    return runCluster(options.workers, [state, &options](uint32_t worker) {
+        return runWorker(*state, worker, options);
+    }, ready);
+}
+
+int main(int argc, char** argv) {
+    Options options = parseOptions(argc, argv);
+
+    if (!options.upgradeSocket.empty() || !options.takeOver.empty()) {
+        return runUpgradable(options);
+    }
+
+    if (options.workers == 1) {
+        return runWorker(*GameState::map(), 0, options);
+    }
+
+    // Named per port so several nodes can run on one host
+    std::string shmName = "/web-counter-game-" + std::to_string(options.port);
+    GameState* state = GameState::map(shmName.c_str());
+    int result = runCluster(options.workers, [state, &options](uint32_t worker) {
+        return runWorker(*state, worker, options);
+    });
+    shm_unlink(shmName.c_str());
+    return result;
+}
@@ -0,0 +1,230 @@
+#pragma once
+
+#include "crow_all.h"
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Crow middleware that keeps whole GET responses of chosen routes for a
+// short TTL, so a crowd asking for the same view in the same instant costs
+// one handler call. A key is the route's path plus the query parameters and
+// request headers the route names, so other parameters can't multiply the
+// entries. While a handler runs for a key, other requests for it are parked
+// without holding up their io thread and answered with its response, each
+// on its own connection's io_context; a handler that doesn't answer within
+// waitLimit loses the key to the next request, and whichever answers first
+// answers everyone parked until then.
+// Only 200 responses without cookies are kept. The handler always renders
+// the full response, If-None-Match is taken off the request that fills a
+// key and applied to what is kept, which answers it with 304 on an ETag
+// match like every later request. With CROW_ENABLE_COMPRESSION the body is
+// also kept gzipped, compressed once per fill rather than once per request.
+struct MicroCache {
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr size_t maxEntries = 4096;
+    static constexpr std::chrono::milliseconds waitLimit{1000};
+
+    struct context {
+        std::string key;
+        uint64_t fill = 0;       // Non-zero while this request runs the handler for key
+        std::string ifNoneMatch; // Taken off the request that fills
+    };
+
+    // Caches GET responses for path, which must match req.url exactly. Only
+    // the query parameters in params and the headers in vary tell them apart.
+    MicroCache& cache(const std::string& path, std::chrono::milliseconds ttl, std::vector<std::string> params = {},
+                      std::vector<std::string> vary = {}) {
+        rules[path] = Rule{ttl, std::move(params), std::move(vary)};
+        return *this;
+    }
+
+    void before_handle(crow::request& req, crow::response& res, context& ctx) {
+        if (req.method != crow::HTTPMethod::Get) return;
+        auto rule = rules.find(req.url);
+        if (rule == rules.end() || rule->second.ttl.count() <= 0) return;
+
+        // A present parameter is written with its '=', so an empty value and no value differ
+        ctx.key = req.url;
+        for (const auto& param : rule->second.params) {
+            ctx.key += '\n';
+            if (const char* value = req.url_params.get(param)) {
+                ctx.key += '=';
+                ctx.key += value;
+            }
+        }
+        for (const auto& header : rule->second.vary) {
+            ctx.key += '\n';
+            ctx.key += req.get_header_value(header);
+        }
+
+        std::unique_lock<std::mutex> lock(mutex);
+        auto now = Clock::now();
+        auto it = entries.find(ctx.key);
+        if (it == entries.end() && !makeRoom()) {
+            ctx.key.clear(); // Too many distinct keys; serve this one uncached
+            return;
+        }
+        if (it == entries.end() || (it->second.filling ? it->second.fillStarted + waitLimit <= now : it->second.expires <= now)) {
+            Entry& entry = entries[ctx.key];
+            entry.filling = true;
+            entry.fillStarted = now;
+            entry.ttl = rule->second.ttl;
+            entry.fill = ctx.fill = ++fills;
+            ctx.ifNoneMatch = req.get_header_value("If-None-Match");
+            req.headers.erase("If-None-Match");
+            return;
+        }
+        if (!it->second.filling) {
+            std::shared_ptr<const Stored> stored = it->second.response;
+            lock.unlock();
+            serve(stored.get(), req, res);
+            return;
+        }
+        it->second.waiters.push_back(Waiter{&req, &res, req.io_context});
+        res.defer();
+    }
+
+    void after_handle(crow::request& /*req*/, crow::response& res, context& ctx) {
+        if (!ctx.fill) return;
+
+        // Parked requests get the response whatever its code, minus the filler's cookies
+        std::shared_ptr<const Stored> stored;
+        if (!res.is_static_type()) {
+            auto next = std::make_shared<Stored>();
+            next->code = res.code;
+            for (const auto& header : res.headers) {
+                if (!crow::ci_key_eq()(header.first, "Set-Cookie")) next->headers.push_back(header);
+            }
+            next->body = res.body;
+#ifdef CROW_ENABLE_COMPRESSION
+            next->gzipped = crow::compression::compress_string(res.body, crow::compression::algorithm::GZIP);
+#endif
+            stored = std::move(next);
+        }
+        bool keep = stored && res.code == 200 && !res.headers.count("Set-Cookie");
+
+        std::vector<Waiter> waiters;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = entries.find(ctx.key);
+            if (it != entries.end()) {
+                waiters.swap(it->second.waiters);
+                // A fill that was taken over leaves the entry to the one that took it
+                if (it->second.fill == ctx.fill) {
+                    if (keep) {
+                        it->second.response = stored;
+                        it->second.expires = Clock::now() + it->second.ttl;
+                        it->second.filling = false;
+                    } else {
+                        entries.erase(it); // Not cacheable; the next request runs the handler itself
+                    }
+                }
+            }
+        }
+
+        res.set_header("X-Cache", "MISS");
+        if (keep && !ctx.ifNoneMatch.empty() && res.get_header_value("ETag") == ctx.ifNoneMatch) {
+            res.code = 304;
+            res.body.clear();
+        }
+
+        for (const Waiter& waiter : waiters) {
+            crow::asio::post(*waiter.io, [waiter, stored]() {
+                serve(stored.get(), *waiter.req, *waiter.res);
+            });
+        }
+    }
+
+private:
+    struct Rule {
+        std::chrono::milliseconds ttl;
+        std::vector<std::string> params;
+        std::vector<std::string> vary;
+    };
+
+    struct Stored {
+        int code;
+        std::vector<std::pair<std::string, std::string>> headers;
+        std::string body;
+#ifdef CROW_ENABLE_COMPRESSION
+        std::string gzipped;
+#endif
+    };
+
+    // A request parked while its key fills, answered on its own io_context
+    struct Waiter {
+        crow::request* req;
+        crow::response* res;
+        crow::asio::io_context* io;
+    };
+
+    struct Entry {
+        bool filling = false;
+        uint64_t fill = 0; // Which fill is running or produced response
+        Clock::time_point fillStarted;
+        Clock::time_point expires;
+        std::chrono::milliseconds ttl{0};
+        std::shared_ptr<const Stored> response;
+        std::vector<Waiter> waiters;
+    };
+
+    std::unordered_map<std::string, Rule> rules; // Set up before the server starts, read-only after
+    std::mutex mutex;
+    std::unordered_map<std::string, Entry> entries;
+    uint64_t fills = 0;
+
+    // Drops expired entries once the table is full; false if it still is
+    bool makeRoom() {
+        if (entries.size() < maxEntries) return true;
+        auto now = Clock::now();
+        for (auto it = entries.begin(); it != entries.end();) {
+            if (!it->second.filling && it->second.expires <= now) {
+                it = entries.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        return entries.size() < maxEntries;
+    }
+
+    // Answers from a kept response; without one, e.g. when the filler sent
+    // a file, the client is asked to retry
+    static void serve(const Stored* stored, const crow::request& req, crow::response& res) {
+        if (!stored) {
+            res.code = 503;
+            res.set_header("Retry-After", "0");
+            res.end();
+            return;
+        }
+        res.code = stored->code;
+        for (const auto& header : stored->headers) {
+            res.add_header(header.first, header.second);
+        }
+        res.set_header("X-Cache", "HIT");
+
+        auto etag = res.headers.find("ETag");
+        if (res.code == 200 && etag != res.headers.end() && req.get_header_value("If-None-Match") == etag->second) {
+            res.code = 304;
+        } else {
+#ifdef CROW_ENABLE_COMPRESSION
+            if (req.get_header_value("Accept-Encoding").find("gzip") != std::string::npos) {
+                res.body = stored->gzipped;
+                res.set_header("Content-Encoding", "gzip");
+                res.compressed = false;
+            } else {
+                res.body = stored->body;
+            }
+#else
+            res.body = stored->body;
+#endif
+        }
+        res.end();
+    }
+};
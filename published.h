@@ -0,0 +1,111 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+// Holds the current version of an immutable value, which readers keep
+// alive for as long as they use it and writers may replace as often as once
+// per click: a replaced version is freed as soon as no reader can still
+// hold it. Each reader announces the epoch it started in, in a free slot
+// found from its thread's own; a version retired in an epoch is freed once
+// no reader announced that epoch or an earlier one. A reader that finds
+// every slot taken, e.g. with deeply nested reads, is counted instead, and
+// nothing is freed while any such reader is left.
+template<typename T>
+class Published {
+public:
+    static constexpr size_t slotCount = 256;
+
+    // The version current when it was taken, kept alive until destroyed
+    class Reader {
+    public:
+        Reader(const Reader&) = delete;
+        Reader& operator=(const Reader&) = delete;
+
+        ~Reader() {
+            if (slot) {
+                slot->store(0, std::memory_order_release);
+            } else {
+                owner.unslotted.fetch_sub(1, std::memory_order_release);
+            }
+        }
+
+        const T& operator*() const {
+            return *value;
+        }
+
+        const T* operator->() const {
+            return value;
+        }
+
+    private:
+        friend class Published;
+
+        Reader(const Published& owner) : owner(owner) {
+            size_t start = threadIndex();
+            for (size_t i = 0; i < slotCount && !slot; ++i) {
+                std::atomic<uint64_t>& candidate = owner.slots[(start + i) % slotCount].epoch;
+                uint64_t free = 0;
+                if (candidate.load(std::memory_order_relaxed) == 0 && candidate.compare_exchange_strong(free, owner.epoch.load())) {
+                    slot = &candidate;
+                }
+            }
+            if (!slot) owner.unslotted.fetch_add(1);
+            // Announced before the load: a version swapped out after this
+            // point is retired in our epoch or later and stays alive
+            value = owner.current.load();
+        }
+
+        const Published& owner;
+        std::atomic<uint64_t>* slot = nullptr;
+        const T* value;
+    };
+
+    explicit Published(std::unique_ptr<const T> initial) : current(initial.release()) {}
+
+    ~Published() {
+        delete current.load();
+    }
+
+    Reader read() const {
+        return Reader(*this);
+    }
+
+    // One writer at a time
+    void publish(std::unique_ptr<const T> next) {
+        const T* replaced = current.exchange(next.release());
+        retired.emplace_back(epoch.fetch_add(1), replaced);
+
+        uint64_t oldest = unslotted.load() != 0 ? 0 : UINT64_MAX;
+        for (const auto& slot : slots) {
+            uint64_t announced = slot.epoch.load();
+            if (announced != 0) oldest = std::min(oldest, announced);
+        }
+        retired.erase(std::remove_if(retired.begin(), retired.end(), [oldest](const auto& entry) {
+                          return entry.first < oldest;
+                      }),
+                      retired.end());
+    }
+
+private:
+    struct alignas(64) Slot {
+        std::atomic<uint64_t> epoch{0}; // 0 while no reader holds it
+    };
+
+    std::atomic<const T*> current;
+    std::atomic<uint64_t> epoch{1};
+    mutable Slot slots[slotCount];
+    mutable std::atomic<size_t> unslotted{0}; // Readers that found no free slot
+    std::vector<std::pair<uint64_t, std::unique_ptr<const T>>> retired; // Writer only
+
+    static size_t threadIndex() {
+        static std::atomic<size_t> threads{0};
+        thread_local size_t index = threads.fetch_add(1);
+        return index;
+    }
+};
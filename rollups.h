@@ -0,0 +1,103 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Min, max, last value and click count of the counter per time bucket, kept
+// in a fixed ring. Every field is a 64-bit word tagged with its bucket
+// number in the high half, so an update that finds an older tag starts the
+// bucket afresh and one that finds a newer tag is stale and dropped. That
+// keeps updates lock-free without a separate reset step, which matters
+// because the rings live in memory shared by all worker processes.
+template<size_t Buckets, int64_t Seconds>
+struct Rollup {
+    static constexpr size_t buckets = Buckets;
+    static constexpr int64_t seconds = Seconds;
+
+    struct Bucket {
+        std::atomic<uint64_t> min;
+        std::atomic<uint64_t> max;
+        std::atomic<uint64_t> last;
+        std::atomic<uint64_t> count;
+    };
+
+    struct Point {
+        uint64_t count; // 0 when nothing happened in the bucket
+        int min;
+        int max;
+        int last;
+    };
+
+    Bucket ring[Buckets];
+
+    void record(int64_t time, int value) {
+        uint32_t tag = static_cast<uint32_t>(time / Seconds);
+        Bucket& bucket = ring[tag % Buckets];
+        uint64_t word = pack(tag, encode(value));
+        update(bucket.min, word, [](uint64_t current, uint64_t next) { return next < current; });
+        update(bucket.max, word, [](uint64_t current, uint64_t next) { return next > current; });
+        update(bucket.last, word, [](uint64_t, uint64_t) { return true; });
+
+        uint64_t current = bucket.count.load(std::memory_order_relaxed);
+        uint64_t next;
+        do {
+            if (tagOf(current) > tag) return;
+            next = tagOf(current) == tag ? current + 1 : pack(tag, 1);
+        } while (!bucket.count.compare_exchange_weak(current, next, std::memory_order_relaxed));
+    }
+
+    // Bucket that contains time; count is 0 if it was never written or has been reused since
+    Point read(int64_t time) const {
+        uint32_t tag = static_cast<uint32_t>(time / Seconds);
+        const Bucket& bucket = ring[tag % Buckets];
+        uint64_t count = bucket.count.load(std::memory_order_relaxed);
+        uint64_t min = bucket.min.load(std::memory_order_relaxed);
+        uint64_t max = bucket.max.load(std::memory_order_relaxed);
+        uint64_t last = bucket.last.load(std::memory_order_relaxed);
+        if (tagOf(count) != tag || tagOf(min) != tag || tagOf(max) != tag || tagOf(last) != tag) {
+            return Point{0, 0, 0, 0};
+        }
+        return Point{count & 0xffffffff, decode(min), decode(max), decode(last)};
+    }
+
+private:
+    static uint64_t pack(uint32_t tag, uint32_t low) {
+        return (static_cast<uint64_t>(tag) << 32) | low;
+    }
+
+    static uint32_t tagOf(uint64_t word) {
+        return static_cast<uint32_t>(word >> 32);
+    }
+
+    // Flipping the sign bit makes unsigned order match signed order
+    static uint32_t encode(int value) {
+        return static_cast<uint32_t>(value) ^ 0x80000000u;
+    }
+
+    static int decode(uint64_t word) {
+        return static_cast<int>(static_cast<uint32_t>(word) ^ 0x80000000u);
+    }
+
+    // Same-bucket words compare by value since their high halves are equal
+    template<typename Better>
+    static void update(std::atomic<uint64_t>& field, uint64_t word, Better better) {
+        uint64_t current = field.load(std::memory_order_relaxed);
+        while (tagOf(current) < tagOf(word) || (tagOf(current) == tagOf(word) && better(current, word))) {
+            if (field.compare_exchange_weak(current, word, std::memory_order_relaxed)) return;
+        }
+    }
+};
+
+// One hour by second, one day by minute and thirty days by hour
+struct CounterRollups {
+    Rollup<3600, 1> seconds;
+    Rollup<1440, 60> minutes;
+    Rollup<720, 3600> hours;
+
+    void record(int64_t time, int value) {
+        seconds.record(time, value);
+        minutes.record(time, value);
+        hours.record(time, value);
+    }
+};
@@ -0,0 +1,337 @@
+#pragma once
+
+#include "hyperloglog.h"
+#include "leaderboard.h"
+#include "rollups.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Game state that lives in memory shared by every worker process. It only
+// holds fixed-size fields and lock-free atomics, so a worker that dies at any
+// point can't leave a lock held or the layout half-built for the others.
+struct GameState {
+    static constexpr size_t eventCapacity = 64;
+    static constexpr size_t nameCapacity = 64;
+
+    // One click in the event ring, guarded by a per-slot sequence number: it
+    // holds 2 * ticket + 1 while ticket is being written and 2 * ticket + 2
+    // once it is complete, so readers can tell torn or stale slots apart.
+    struct EventSlot {
+        std::atomic<uint64_t> seq;
+        char name[nameCapacity];
+        bool increment;
+        int value;
+        int64_t time;
+        uint32_t worker;
+    };
+
+    struct EventRecord {
+        uint64_t ticket;
+        std::string name;
+        bool increment;
+        int value;
+        int64_t time;
+        uint32_t worker;
+    };
+
+    static constexpr size_t maxNodes = 32;
+
+    // Worker id recorded for events that arrived through log replication
+    static constexpr uint32_t replicatedWorker = UINT32_MAX;
+
+    // Another node's share of the counter as last heard over gossip
+    struct NodeTally {
+        std::atomic<uint64_t> node; // 0 marks a free slot
+        std::atomic<uint64_t> plus;
+        std::atomic<uint64_t> minus;
+    };
+
+    // Bump whenever a field changes meaning, so a new build never attaches to
+    // an old build's memory it would misread
+    static constexpr uint64_t layoutVersion = 3;
+
+    uint64_t layout; // layoutTag() of the build that created the memory
+
+    // The counter isn't stored: it is this node's plusClicks - minusClicks plus
+    // the same for every remote tally, i.e. the value of the PN-counter across
+    // all nodes, so it can never disagree with the tallies
+    std::atomic<uint64_t> plusClicks;
+    std::atomic<uint64_t> minusClicks;
+    std::atomic<uint64_t> eventHead; // Next ticket to hand out
+    std::atomic<uint64_t> replicatedSeq; // Next sequence number expected from the event log leader
+    EventSlot events[eventCapacity];
+    NodeTally remoteTallies[maxNodes];
+    CounterRollups rollups;
+    UniquePlayers uniquePlayers;
+    Leaderboard leaderboard;
+
+    static_assert(std::atomic<int>::is_always_lock_free && std::atomic<uint64_t>::is_always_lock_free,
+                  "shared state needs lock-free atomics to be usable across processes");
+
+    // Applies one click and returns the counter right after it
+    int click(bool increment) {
+        (increment ? plusClicks : minusClicks).fetch_add(1);
+        return counter();
+    }
+
+    // PN-counter merge: each tally only ever grows, so keep the larger of the
+    // known and received one, which moves the counter by the difference. A tally
+    // for our own node id restores clicks a restarted node had lost.
+    bool mergeTally(uint64_t selfNode, uint64_t node, uint64_t plus, uint64_t minus) {
+        if (node == 0) return false;
+
+        std::atomic<uint64_t>* plusTally = &plusClicks;
+        std::atomic<uint64_t>* minusTally = &minusClicks;
+        if (node != selfNode) {
+            NodeTally* tally = findTally(node);
+            if (!tally) return false;
+            plusTally = &tally->plus;
+            minusTally = &tally->minus;
+        }
+
+        raise(*plusTally, plus);
+        raise(*minusTally, minus);
+        return true;
+    }
+
+    // Every click this node knows of, its own or merged from another node's
+    // tally, plus every event its ring has taken. It moves whenever the
+    // counter or the events do and never goes back, so clients can wait for
+    // it to pass the version they last saw, and a click's row arriving after
+    // its tally moves it again.
+    uint64_t version() const {
+        uint64_t head = eventHead.load();
+        Totals all = totals();
+        return all.plus + all.minus + head;
+    }
+
+    struct Totals {
+        uint64_t plus;
+        uint64_t minus;
+
+        int counter() const {
+            return static_cast<int>(static_cast<int64_t>(plus - minus));
+        }
+    };
+
+    int counter() const {
+        return totals().counter();
+    }
+
+    // Clicks per team across all nodes; plus - minus is the counter
+    Totals totals() const {
+        Totals all{plusClicks.load(), minusClicks.load()};
+        for (const auto& tally : remoteTallies) {
+            all.plus += tally.plus.load(std::memory_order_relaxed);
+            all.minus += tally.minus.load(std::memory_order_relaxed);
+        }
+        return all;
+    }
+
+    // Never waits. Once the ring wraps, a writer that fell a whole lap
+    // behind leaves the slot to the newer ticket instead of overwriting it,
+    // and only completes the slot if no newer ticket took it meanwhile.
+    uint64_t appendEvent(std::string_view name, bool increment, int value, uint32_t worker, int64_t time = 0) {
+        uint64_t ticket = eventHead.fetch_add(1);
+        EventSlot& slot = events[ticket % eventCapacity];
+
+        uint64_t writing = 2 * ticket + 1;
+        uint64_t current = slot.seq.load(std::memory_order_relaxed);
+        do {
+            if (current >= writing) return ticket;
+        } while (!slot.seq.compare_exchange_weak(current, writing, std::memory_order_relaxed));
+        std::atomic_thread_fence(std::memory_order_release);
+
+        // Names are cut to the slot size on a UTF-8 character boundary
+        size_t length = std::min(name.size(), nameCapacity - 1);
+        while (length > 0 && length < name.size() && (static_cast<unsigned char>(name[length]) & 0xC0) == 0x80) {
+            --length;
+        }
+        std::memcpy(slot.name, name.data(), length);
+        slot.name[length] = '\0';
+        slot.increment = increment;
+        slot.value = value;
+        slot.time = time != 0 ? time : static_cast<int64_t>(std::time(nullptr));
+        slot.worker = worker;
+
+        slot.seq.compare_exchange_strong(writing, 2 * ticket + 2, std::memory_order_release, std::memory_order_relaxed);
+        return ticket;
+    }
+
+    // Copies out the event with the given ticket; fails if it is still being
+    // written, was overwritten, or its writer died halfway through
+    bool readEvent(uint64_t ticket, EventRecord& out) const {
+        const EventSlot& slot = events[ticket % eventCapacity];
+        for (int attempt = 0; attempt < 8; ++attempt) {
+            uint64_t before = slot.seq.load(std::memory_order_acquire);
+            if (before != 2 * ticket + 2) {
+                if (before == 2 * ticket + 1) continue;
+                return false;
+            }
+
+            char name[nameCapacity];
+            std::memcpy(name, slot.name, nameCapacity);
+            out.increment = slot.increment;
+            out.value = slot.value;
+            out.time = slot.time;
+            out.worker = slot.worker;
+            std::atomic_thread_fence(std::memory_order_acquire);
+
+            if (slot.seq.load(std::memory_order_relaxed) == before) {
+                name[nameCapacity - 1] = '\0';
+                out.name = name;
+                out.ticket = ticket;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Newest events first, skipping any that can't be read consistently
+    std::vector<EventRecord> recentEvents(size_t count) const {
+        std::vector<EventRecord> result;
+        uint64_t head = eventHead.load(std::memory_order_acquire);
+        uint64_t oldest = head > eventCapacity ? head - eventCapacity : 0;
+        EventRecord record;
+        for (uint64_t ticket = head; ticket > oldest && result.size() < count; --ticket) {
+            if (readEvent(ticket - 1, record)) {
+                result.push_back(record);
+            }
+        }
+        return result;
+    }
+
+    // Slot for a remote node, claiming a free one the first time it is heard from
+    NodeTally* findTally(uint64_t node) {
+        for (auto& tally : remoteTallies) {
+            uint64_t current = tally.node.load();
+            if (current == 0 && tally.node.compare_exchange_strong(current, node)) {
+                return &tally;
+            }
+            if (current == node) {
+                return &tally;
+            }
+        }
+        return nullptr;
+    }
+
+    // Raises value to at least target and returns by how much it grew
+    static uint64_t raise(std::atomic<uint64_t>& value, uint64_t target) {
+        uint64_t current = value.load();
+        while (current < target) {
+            if (value.compare_exchange_weak(current, target)) {
+                return target - current;
+            }
+        }
+        return 0;
+    }
+
+    static uint64_t layoutTag() {
+        return (layoutVersion << 32) | sizeof(GameState);
+    }
+
+    // Counter and tallies as text, for handing over to a build whose layout differs
+    std::string snapshot() const {
+        std::ostringstream out;
+        out << "counter " << counter() << '\n'
+            << "clicks " << plusClicks.load() << ' ' << minusClicks.load() << '\n'
+            << "seq " << replicatedSeq.load() << '\n';
+        for (const auto& tally : remoteTallies) {
+            uint64_t node = tally.node.load();
+            if (node != 0) {
+                out << "tally " << node << ' ' << tally.plus.load() << ' ' << tally.minus.load() << '\n';
+            }
+        }
+        return out.str();
+    }
+
+    // Applies a snapshot() to a fresh state; unknown lines are skipped, and so
+    // is the counter, which follows from the tallies
+    void restore(const std::string& snapshot) {
+        std::istringstream in(snapshot);
+        std::string line;
+        while (std::getline(in, line)) {
+            std::istringstream fields(line);
+            std::string kind;
+            fields >> kind;
+            if (kind == "clicks") {
+                uint64_t plus, minus;
+                if (fields >> plus >> minus) plusClicks.store(plus), minusClicks.store(minus);
+            } else if (kind == "seq") {
+                uint64_t seq;
+                if (fields >> seq) replicatedSeq.store(seq);
+            } else if (kind == "tally") {
+                uint64_t node, plus, minus;
+                NodeTally* tally;
+                if (fields >> node >> plus >> minus && (tally = findTally(node))) {
+                    tally->plus.store(plus);
+                    tally->minus.store(minus);
+                }
+            }
+        }
+    }
+
+    // Maps a zeroed GameState. With a name it is a POSIX shared-memory
+    // segment that forked workers keep sharing; without one it is private.
+    static GameState* map(const char* shmName = nullptr) {
+        if (shmName) {
+            int fd = create(shmName);
+            GameState* state = attach(fd);
+            close(fd);
+            return state;
+        }
+        void* memory = mmap(nullptr, sizeof(GameState), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED) throw std::runtime_error("mmap failed for game state");
+        // Fresh mappings are zero-filled, which is a valid initial state for every field
+        auto* state = static_cast<GameState*>(memory);
+        state->layout = layoutTag();
+        return state;
+    }
+
+    // Creates the memory for a fresh GameState and returns its descriptor, which
+    // can be passed to another process. Without a name it is an anonymous memfd.
+    static int create(const char* shmName = nullptr) {
+        int fd;
+        if (shmName) {
+            shm_unlink(shmName);
+            fd = shm_open(shmName, O_CREAT | O_EXCL | O_RDWR, 0600);
+        } else {
+            fd = memfd_create("web-counter-game", MFD_CLOEXEC);
+        }
+        if (fd < 0) throw std::runtime_error("cannot create game state memory");
+        if (ftruncate(fd, sizeof(GameState)) != 0) {
+            close(fd);
+            throw std::runtime_error("ftruncate failed for game state");
+        }
+        GameState* state = attach(fd);
+        state->layout = layoutTag();
+        munmap(state, sizeof(GameState));
+        return fd;
+    }
+
+    // Maps the GameState behind a descriptor from create(), possibly made by another process
+    static GameState* attach(int fd) {
+        void* memory = mmap(nullptr, sizeof(GameState), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (memory == MAP_FAILED) throw std::runtime_error("mmap failed for game state");
+        return static_cast<GameState*>(memory);
+    }
+
+    // Whether a descriptor from another process holds a GameState this build can use
+    static bool compatible(int fd) {
+        uint64_t layout = 0;
+        return pread(fd, &layout, sizeof(layout), offsetof(GameState, layout)) == sizeof(layout) && layout == layoutTag();
+    }
+};
@@ -0,0 +1,238 @@
+#pragma once
+
+#include "crow_all.h"
+#include "published.h"
+#include "shared_state.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+// Settings read from the config file, one "key = value" per line, # for comments:
+//   port = 8080        listening port, only read at startup
+//   events = 5         rows in the recent events table
+//   refresh = 2        0 turns off live page updates; else the reload interval without JavaScript
+//   assets = ./assets  directory served under /assets/; its style.css replaces the built-in style
+struct Settings {
+    uint16_t port = 8080;
+    size_t events = 5;
+    int refresh = 2;
+    std::string assets;
+
+    // Keeps the defaults for missing keys; throws on anything it can't read
+    static Settings load(const std::string& path) {
+        Settings settings;
+        std::ifstream file(path);
+        if (!file) throw std::runtime_error("cannot read " + path);
+
+        std::string line;
+        for (int number = 1; std::getline(file, line); ++number) {
+            line = line.substr(0, line.find('#'));
+            size_t equals = line.find('=');
+            if (line.find_first_not_of(" \t\r") == std::string::npos) continue;
+            if (equals == std::string::npos) throw std::runtime_error(path + ":" + std::to_string(number) + ": expected key = value");
+
+            std::string key = trim(line.substr(0, equals));
+            std::string value = trim(line.substr(equals + 1));
+            try {
+                if (key == "port") settings.port = static_cast<uint16_t>(std::stoi(value));
+                else if (key == "events") settings.events = std::stoul(value);
+                else if (key == "refresh") settings.refresh = std::max(0, std::stoi(value));
+                else if (key == "assets") settings.assets = value;
+                else throw std::runtime_error("unknown key " + key);
+            } catch (const std::logic_error&) {
+                throw std::runtime_error(path + ":" + std::to_string(number) + ": bad value for " + key);
+            }
+        }
+        return settings;
+    }
+
+    static std::string trim(const std::string& value) {
+        size_t first = value.find_first_not_of(" \t\r");
+        if (first == std::string::npos) return "";
+        return value.substr(first, value.find_last_not_of(" \t\r") - first + 1);
+    }
+};
+
+// One file of the asset directory, rendered once per reload
+struct Asset {
+    std::string content;
+#ifdef CROW_ENABLE_COMPRESSION
+    std::string gzipped;
+#endif
+    std::string contentType;
+    std::string etag;
+};
+
+// Everything a request renders from; replaced as a whole on every reload
+struct SiteConfig {
+    Settings settings;
+    std::string style; // <style> block put in every page
+    std::unordered_map<std::string, Asset> assets;
+    std::string page;  // Page that is the same for every visitor, rendered once per reload
+    std::string pageEtag;
+};
+
+// Loads the config file and asset directory, then keeps watching both with
+// inotify from its own thread and publishes a new SiteConfig whenever
+// either changes. A file that fails to load keeps the previous version.
+class SiteConfigWatcher {
+public:
+    using PageRenderer = std::function<std::string(const SiteConfig&)>;
+
+    SiteConfigWatcher(std::string configPath, std::string defaultStyle, PageRenderer renderPage = nullptr) :
+        configPath(std::move(configPath)), defaultStyle(std::move(defaultStyle)), renderPage(std::move(renderPage)),
+        site(render(loadSettings())) {
+        if (this->configPath.empty()) return;
+
+        inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (inotifyFd < 0) {
+            CROW_LOG_WARNING << "inotify unavailable, " << this->configPath << " will not be reloaded";
+            return;
+        }
+        watchDirectories(site.read()->settings.assets);
+        thread = std::thread([this]() {
+            watch();
+        });
+    }
+
+    ~SiteConfigWatcher() {
+        stopping = true;
+        if (thread.joinable()) thread.join();
+        if (inotifyFd >= 0) close(inotifyFd);
+    }
+
+    // Keeps the config it returns alive until destroyed
+    Published<SiteConfig>::Reader current() const {
+        return site.read();
+    }
+
+private:
+    std::string configPath;
+    std::string defaultStyle;
+    PageRenderer renderPage;
+    Published<SiteConfig> site;
+    int inotifyFd = -1;
+    int configWatch = -1;
+    int assetsWatch = -1;
+    std::string watchedAssets;
+    std::atomic<bool> stopping{false};
+    std::thread thread;
+
+    Settings loadSettings() {
+        return configPath.empty() ? Settings() : Settings::load(configPath);
+    }
+
+    std::unique_ptr<const SiteConfig> render(Settings settings) {
+        auto next = std::make_unique<SiteConfig>();
+        next->style = defaultStyle;
+
+        std::error_code ec;
+        if (!settings.assets.empty()) {
+            for (const auto& entry : std::filesystem::directory_iterator(settings.assets, ec)) {
+                if (!entry.is_regular_file()) continue;
+                std::ifstream file(entry.path(), std::ios::binary);
+                std::ostringstream content;
+                content << file.rdbuf();
+
+                std::string name = entry.path().filename().string();
+                Asset asset;
+                asset.content = content.str();
+#ifdef CROW_ENABLE_COMPRESSION
+                asset.gzipped = crow::compression::compress_string(asset.content, crow::compression::algorithm::GZIP);
+#endif
+                std::string extension = entry.path().extension().string();
+                auto type = crow::mime_types.find(extension.empty() ? "" : extension.substr(1));
+                asset.contentType = type != crow::mime_types.end() ? type->second : "application/octet-stream";
+                asset.etag = "\"" + std::to_string(std::hash<std::string>()(asset.content)) + "\"";
+
+                if (name == "style.css") {
+                    next->style = "<style>" + asset.content + "</style>";
+                }
+                next->assets.emplace(std::move(name), std::move(asset));
+            }
+        }
+
+        settings.events = std::min<size_t>(std::max<size_t>(settings.events, 1), GameState::eventCapacity);
+        next->settings = std::move(settings);
+        if (renderPage) {
+            next->page = renderPage(*next);
+            next->pageEtag = "\"" + std::to_string(std::hash<std::string>()(next->page)) + "\"";
+        }
+        return next;
+    }
+
+    void reload() {
+        try {
+            Settings settings = loadSettings();
+            if (settings.port != site.read()->settings.port) {
+                CROW_LOG_WARNING << "port change in " << configPath << " takes effect after a restart";
+            }
+            watchDirectories(settings.assets);
+            site.publish(render(std::move(settings)));
+            CROW_LOG_INFO << "Reloaded " << configPath;
+        } catch (const std::exception& e) {
+            CROW_LOG_WARNING << "Keeping previous config: " << e.what();
+        }
+    }
+
+    // Editors often replace a file instead of writing it, so the config's
+    // directory is watched rather than the file itself
+    void watchDirectories(const std::string& assets) {
+        if (configWatch < 0) {
+            std::string directory = std::filesystem::path(configPath).parent_path().string();
+            configWatch = inotify_add_watch(inotifyFd, directory.empty() ? "." : directory.c_str(),
+                                            IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE);
+        }
+        if (assets != watchedAssets) {
+            if (assetsWatch >= 0) inotify_rm_watch(inotifyFd, assetsWatch);
+            assetsWatch = assets.empty() ? -1 : inotify_add_watch(inotifyFd, assets.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE | IN_MOVED_FROM);
+            watchedAssets = assets;
+        }
+    }
+
+    void watch() {
+        std::string configName = std::filesystem::path(configPath).filename().string();
+        alignas(inotify_event) char buffer[4096];
+
+        while (!stopping) {
+            pollfd fd{inotifyFd, POLLIN, 0};
+            if (poll(&fd, 1, 500) <= 0) continue;
+
+            bool changed = false;
+            ssize_t size;
+            while ((size = read(inotifyFd, buffer, sizeof(buffer))) > 0) {
+                for (char* pos = buffer; pos < buffer + size;) {
+                    auto* event = reinterpret_cast<inotify_event*>(pos);
+                    pos += sizeof(inotify_event) + event->len;
+                    if (event->wd == assetsWatch || (event->len > 0 && configName == event->name)) {
+                        changed = true;
+                    }
+                }
+            }
+            if (changed) {
+                // A save often comes as several events; let them settle into one reload
+                std::this_thread::sleep_for(std::chrono::milliseconds(50));
+                while (read(inotifyFd, buffer, sizeof(buffer)) > 0) {
+                }
+                reload();
+            }
+        }
+    }
+};
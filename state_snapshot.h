@@ -0,0 +1,46 @@
+#pragma once
+
+#include "published.h"
+#include "shared_state.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// What the pages show of the game, copied out of GameState in one go and
+// never changed after, so a page rendered from it can't pair the counter of
+// one moment with the rows of another
+struct StateSnapshot {
+    uint64_t version;     // GameState::version() it was taken at
+    uint64_t eventHead;
+    size_t eventCount;    // Events asked for; fewer are kept if some can't be read
+    int counter;
+    uint64_t plusClicks;  // Across all nodes
+    uint64_t minusClicks;
+    std::vector<GameState::EventRecord> events; // Newest first
+    std::string json;     // /api/state body, rendered once per snapshot
+
+    // Takes the tallies and the newest events again if a click lands while
+    // they are copied; the counter is computed from the same tallies. A click
+    // whose event isn't written yet shows in the counter first and gets its
+    // row in the snapshot taken after it, which has a higher version.
+    static std::unique_ptr<StateSnapshot> capture(const GameState& state, size_t eventCount) {
+        auto snapshot = std::make_unique<StateSnapshot>();
+        snapshot->eventCount = eventCount;
+        for (int attempt = 0; attempt < 4; ++attempt) {
+            uint64_t head = state.eventHead.load();
+            GameState::Totals totals = state.totals();
+            snapshot->events = state.recentEvents(eventCount);
+            GameState::Totals after = state.totals();
+
+            snapshot->eventHead = head;
+            snapshot->plusClicks = totals.plus;
+            snapshot->minusClicks = totals.minus;
+            if (state.eventHead.load() == head && after.plus == totals.plus && after.minus == totals.minus) break;
+        }
+        snapshot->version = snapshot->plusClicks + snapshot->minusClicks + snapshot->eventHead;
+        snapshot->counter = GameState::Totals{snapshot->plusClicks, snapshot->minusClicks}.counter();
+        return snapshot;
+    }
+};
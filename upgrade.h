@@ -0,0 +1,217 @@
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Hands a running instance over to a new one, typically a new build, on a
+// Unix socket. The new process connects and receives, in one message, the
+// listening socket and the game state memory as descriptors, followed by
+//   handoff <generation>
+//   <GameState::snapshot() lines>
+//   end
+// It keeps accepting on the same socket, so no connection is ever refused,
+// and answers "ready" once it is serving; only then does the old process
+// stop accepting and drain. The snapshot is used when the new build can't
+// map the old state memory.
+struct Handoff {
+    int listenFd = -1;
+    int stateFd = -1;
+    uint32_t generation = 0; // Upgrades since the last cold start
+    std::string snapshot;
+    int control = -1; // Connection to the old process, for confirmReady
+};
+
+namespace upgrade_detail {
+    inline sockaddr_un address(const std::string& path) {
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(addr.sun_path)) throw std::invalid_argument("upgrade socket path too long: " + path);
+        std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+        return addr;
+    }
+
+    inline bool writeAll(int fd, const std::string& data) {
+        for (size_t done = 0; done < data.size();) {
+            ssize_t written = ::send(fd, data.data() + done, data.size() - done, MSG_NOSIGNAL);
+            if (written < 0 && errno == EINTR) continue;
+            if (written <= 0) return false;
+            done += written;
+        }
+        return true;
+    }
+}
+
+// Listening TCP socket on all interfaces, to be shared with workers and handed on
+inline int openListener(uint16_t port) {
+    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) throw std::runtime_error("socket failed");
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if (::bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || ::listen(fd, SOMAXCONN) != 0) {
+        ::close(fd);
+        throw std::runtime_error("cannot listen on port " + std::to_string(port));
+    }
+    return fd;
+}
+
+// New side: takes the listening socket and state from the instance serving path
+inline Handoff takeOver(const std::string& path) {
+    int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    sockaddr_un addr = upgrade_detail::address(path);
+    if (fd < 0 || ::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+        if (fd >= 0) ::close(fd);
+        throw std::runtime_error("no running instance to take over at " + path);
+    }
+
+    Handoff handoff;
+    handoff.control = fd;
+
+    char data[4096];
+    alignas(cmsghdr) char control[CMSG_SPACE(2 * sizeof(int))];
+    iovec io{data, sizeof(data)};
+    msghdr message{};
+    message.msg_iov = &io;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    ssize_t size = ::recvmsg(fd, &message, MSG_CMSG_CLOEXEC);
+
+    cmsghdr* header = CMSG_FIRSTHDR(&message);
+    if (size <= 0 || !header || header->cmsg_type != SCM_RIGHTS || header->cmsg_len != CMSG_LEN(2 * sizeof(int))) {
+        ::close(fd);
+        throw std::runtime_error("bad handoff from " + path);
+    }
+    int fds[2];
+    std::memcpy(fds, CMSG_DATA(header), sizeof(fds));
+    handoff.listenFd = fds[0];
+    handoff.stateFd = fds[1];
+
+    std::string text(data, size);
+    while (text.size() < 4 || text.compare(text.size() - 4, 4, "end\n") != 0) {
+        size = ::read(fd, data, sizeof(data));
+        if (size <= 0) {
+            ::close(fd);
+            throw std::runtime_error("handoff from " + path + " ended early");
+        }
+        text.append(data, size);
+    }
+    if (std::sscanf(text.c_str(), "handoff %u", &handoff.generation) != 1) {
+        ::close(fd);
+        throw std::runtime_error("bad handoff from " + path);
+    }
+    handoff.snapshot = text.substr(text.find('\n') + 1);
+    return handoff;
+}
+
+// New side: tells the old process it may stop accepting
+inline void confirmReady(Handoff& handoff) {
+    if (handoff.control < 0) return;
+    upgrade_detail::writeAll(handoff.control, "ready\n");
+    ::close(handoff.control);
+    handoff.control = -1;
+}
+
+// Old side: waits on path for a new process and hands everything over to it.
+// onHandedOver runs on the listener's thread once the new process is ready;
+// a new process that fails before that leaves this one serving as before.
+class UpgradeListener {
+public:
+    UpgradeListener(std::string path, int listenFd, int stateFd, uint32_t generation,
+                    std::function<std::string()> snapshot, std::function<void()> onHandedOver) :
+        path(std::move(path)), listenFd(listenFd), stateFd(stateFd), generation(generation),
+        snapshot(std::move(snapshot)), onHandedOver(std::move(onHandedOver)) {
+        fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        sockaddr_un addr = upgrade_detail::address(this->path);
+        // A leftover socket file from an instance that is gone would block the bind
+        ::unlink(this->path.c_str());
+        if (fd < 0 || ::bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || ::listen(fd, 1) != 0) {
+            if (fd >= 0) ::close(fd);
+            throw std::runtime_error("cannot listen for upgrades on " + this->path);
+        }
+    }
+
+    ~UpgradeListener() {
+        stopping = true;
+        if (thread.joinable()) thread.join();
+        // The file may already belong to the instance that took over, so it is left in place
+        ::close(fd);
+    }
+
+    void start() {
+        thread = std::thread([this]() {
+            run();
+        });
+    }
+
+private:
+    std::string path;
+    int listenFd;
+    int stateFd;
+    uint32_t generation;
+    std::function<std::string()> snapshot;
+    std::function<void()> onHandedOver;
+    int fd = -1;
+    std::atomic<bool> stopping{false};
+    std::thread thread;
+
+    void run() {
+        while (!stopping) {
+            pollfd listener{fd, POLLIN, 0};
+            if (::poll(&listener, 1, 500) <= 0) continue;
+            int client = ::accept4(fd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (client < 0) continue;
+            bool ready = handOver(client);
+            ::close(client);
+            if (ready) {
+                onHandedOver();
+                return;
+            }
+        }
+    }
+
+    bool handOver(int client) {
+        std::string text = "handoff " + std::to_string(generation + 1) + "\n" + snapshot() + "end\n";
+        int fds[2] = {listenFd, stateFd};
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(fds))] = {};
+        iovec io{text.data(), text.size()};
+        msghdr message{};
+        message.msg_iov = &io;
+        message.msg_iovlen = 1;
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+        cmsghdr* header = CMSG_FIRSTHDR(&message);
+        header->cmsg_level = SOL_SOCKET;
+        header->cmsg_type = SCM_RIGHTS;
+        header->cmsg_len = CMSG_LEN(sizeof(fds));
+        std::memcpy(CMSG_DATA(header), fds, sizeof(fds));
+
+        ssize_t sent = ::sendmsg(client, &message, MSG_NOSIGNAL);
+        if (sent <= 0 || !upgrade_detail::writeAll(client, text.substr(sent))) return false;
+
+        // The new process may take a while to start its workers
+        pollfd reply{client, POLLIN, 0};
+        char answer[16] = {};
+        return ::poll(&reply, 1, 30000) > 0 && ::read(client, answer, sizeof(answer) - 1) > 0 &&
+               std::strncmp(answer, "ready", 5) == 0;
+    }
+};
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+// Compact binary messages for websocket subscribers that negotiate the
+// "counter.bin" subprotocol. A message carries one or more frames back to
+// back, each starting with its type byte:
+//   Snapshot: 0x01, zigzag varint value
+//   Name:     0x02, varint id, varint length, name bytes
+//   Update:   0x03, zigzag varint value, varint (name id << 1 | increment)
+//   Reset:    0x04
+// A player name is sent once, in its own message ahead of the first update
+// that uses it; updates refer to it by id, so a typical update is 3-5 bytes.
+// Updates are self-contained, so a slow client may skip all but the latest.
+// The table holds at most maxNames names: the next new name after that is
+// sent behind a Reset frame, on which clients forget every id, and ids
+// start again from 0.
+class WireEncoder {
+public:
+    static constexpr const char* subprotocol = "counter.bin";
+
+    enum FrameType : uint8_t {
+        Snapshot = 0x01,
+        Name = 0x02,
+        Update = 0x03,
+        Reset = 0x04,
+    };
+
+    static constexpr size_t maxNames = 1024;
+
+    // Message for a client that just subscribed: the value and every name known so far
+    std::string snapshot(int value) const {
+        std::string out;
+        out.push_back(static_cast<char>(Snapshot));
+        appendVarint(out, zigzag(value));
+        for (const auto& [name, id] : names) {
+            appendName(out, id, name);
+        }
+        return out;
+    }
+
+    // Id for a player name; a name seen for the first time gets its Name frame put in nameFrame
+    uint32_t intern(std::string_view name, std::string& nameFrame) {
+        auto it = names.find(std::string(name));
+        if (it != names.end()) {
+            return it->second;
+        }
+        if (names.size() == maxNames) {
+            names.clear();
+            nameFrame.push_back(static_cast<char>(Reset));
+        }
+        uint32_t id = static_cast<uint32_t>(names.size());
+        names.emplace(std::string(name), id);
+        appendName(nameFrame, id, name);
+        return id;
+    }
+
+    // Forgets every name, for when no subscriber is left to use them
+    void clear() {
+        names.clear();
+    }
+
+    // Message for one click, shared by all binary subscribers
+    std::string update(uint32_t id, bool increment, int value) const {
+        std::string out;
+        out.push_back(static_cast<char>(Update));
+        appendVarint(out, zigzag(value));
+        appendVarint(out, (static_cast<uint64_t>(id) << 1) | (increment ? 1 : 0));
+        return out;
+    }
+
+private:
+    std::unordered_map<std::string, uint32_t> names;
+
+    static uint64_t zigzag(int64_t value) {
+        return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+    }
+
+    static void appendVarint(std::string& out, uint64_t value) {
+        while (value >= 0x80) {
+            out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+            value >>= 7;
+        }
+        out.push_back(static_cast<char>(value));
+    }
+
+    static void appendName(std::string& out, uint32_t id, std::string_view name) {
+        out.push_back(static_cast<char>(Name));
+        appendVarint(out, id);
+        appendVarint(out, name.size());
+        out.append(name);
+    }
+};